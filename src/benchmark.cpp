@@ -18,12 +18,22 @@
   along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <algorithm>
+#include <chrono>
+#include <deque>
 #include <fstream>
+#include <iomanip>
 #include <iostream>
 #include <istream>
 #include <vector>
 
+#include "evaluate.h"
+#include "material.h"
+#include "movegen.h"
+#include "pawns.h"
 #include "position.h"
+#include "thread.h"
+#include "tt.h"
 
 using namespace std;
 
@@ -38,6 +48,105 @@ const vector<string> Defaults = {
   "6r1/2mnks2/pps1pn1p/2pp1p2/1PNP1P2/P1PKPS1P/2S1N3/R3M3 w 0 16"
 };
 
+// read_fens() returns the positions named by a bench argument: "default"
+// for the built-in list, "current" for the current position, or a file name.
+vector<string> read_fens(const Position& current, const string& fenFile) {
+
+  vector<string> fens;
+
+  if (fenFile == "default")
+      fens = Defaults;
+
+  else if (fenFile == "current")
+      fens.push_back(current.fen());
+
+  else
+  {
+      string fen;
+      ifstream file(fenFile);
+
+      if (!file.is_open())
+      {
+          cerr << "Unable to open file " << fenFile << endl;
+          exit(EXIT_FAILURE);
+      }
+
+      while (getline(file, fen))
+          if (!fen.empty())
+              fens.push_back(fen);
+
+      file.close();
+  }
+
+  return fens;
+}
+
+// Escape is where the micro benchmark results go, so they are not optimized away
+volatile uint64_t Escape;
+
+// time_kernel() runs a pass of a micro benchmark kernel over the corpus a
+// number of times in each of several samples of about 25ms, after a warm-up
+// pass, and reports the median, minimum and spread of the time per call. The
+// kernel adds its results to 'sink', which keeps only the warm-up pass ones.
+template<typename Pass>
+void time_kernel(const char* name, uint64_t& sink, Pass pass) {
+
+  using namespace std::chrono;
+
+  constexpr int Samples = 9;
+  constexpr int64_t SampleNs = 25000000;
+
+  auto run = [&](int64_t reps, uint64_t& calls) {
+      auto start = steady_clock::now();
+      calls = 0;
+      for (int64_t r = 0; r < reps; ++r)
+          calls += pass();
+      return std::max(int64_t(1), (int64_t)duration_cast<nanoseconds>(steady_clock::now() - start).count());
+  };
+
+  uint64_t calls, callsPerPass;
+  int64_t reps = std::max(int64_t(1), SampleNs / run(1, callsPerPass));
+  uint64_t checksum = sink;
+  vector<double> nsPerCall;
+
+  if (!callsPerPass)
+  {
+      cerr << left << setw(22) << name << " no position in the corpus" << endl;
+      return;
+  }
+
+  for (int i = 0; i < Samples; ++i)
+  {
+      int64_t t = run(reps, calls);
+      nsPerCall.push_back(double(t) / calls);
+  }
+
+  Escape = sink; // Keep the results of the samples alive
+  sink = checksum;
+
+  std::sort(nsPerCall.begin(), nsPerCall.end());
+  double median = nsPerCall[Samples / 2];
+
+  cerr << left  << setw(22) << name
+       << right << " calls/pass " << setw(6) << callsPerPass
+       << fixed << setprecision(1)
+       << "  median " << setw(8) << median << " ns"
+       << "  min "    << setw(8) << nsPerCall.front() << " ns"
+       << "  spread " << setw(5) << 100 * (nsPerCall.back() - nsPerCall.front()) / median << "%"
+       << endl;
+}
+
+template<GenType Type>
+uint64_t generate_pass(const vector<Position*>& corpus, uint64_t& sink) {
+
+  ExtMove moves[MAX_MOVES];
+
+  for (Position* pos : corpus)
+      sink += generate<Type>(*pos, moves) - moves;
+
+  return corpus.size();
+}
+
 } // namespace
 
 /// setup_bench() builds a list of UCI commands to be run by bench. There
@@ -65,30 +174,7 @@ vector<string> setup_bench(const Position& current, istream& is) {
   string limitType = (is >> token) ? token : "depth";
 
   go = "go " + limitType + " " + limit;
-
-  if (fenFile == "default")
-      fens = Defaults;
-
-  else if (fenFile == "current")
-      fens.push_back(current.fen());
-
-  else
-  {
-      string fen;
-      ifstream file(fenFile);
-
-      if (!file.is_open())
-      {
-          cerr << "Unable to open file " << fenFile << endl;
-          exit(EXIT_FAILURE);
-      }
-
-      while (getline(file, fen))
-          if (!fen.empty())
-              fens.push_back(fen);
-
-      file.close();
-  }
+  fens = read_fens(current, fenFile);
 
   list.emplace_back("ucinewgame");
   list.emplace_back("setoption name Threads value " + threads);
@@ -105,3 +191,127 @@ vector<string> setup_bench(const Position& current, istream& is) {
 
   return list;
 }
+
+
+/// bench_micro() times the engine hot paths one at a time, so that a change
+/// in, say, movegen.cpp shows up in the kernels it touches instead of as noise
+/// in the full search nps. The corpus is made of the bench positions and of
+/// all the positions one legal move away from them. The checksum of the
+/// results is printed too: it must not change with a pure speed-up.
+///
+/// bench micro -> time the kernels over the default positions
+/// bench micro current -> time the kernels around the current position
+
+void bench_micro(const Position& current, istream& is) {
+
+  string token;
+  string fenFile = (is >> token) ? token : "default";
+  vector<string> fens, corpus;
+  Thread* th = Threads.main();
+
+  th->wait_for_search_finished();
+  fens = read_fens(current, fenFile);
+
+  for (const string& fen : fens)
+  {
+      StateInfo st, st2;
+      Position pos;
+      pos.set(fen, current.is_chess960(), &st, th);
+      corpus.push_back(fen);
+
+      for (const auto& m : MoveList<LEGAL>(pos))
+      {
+          pos.do_move(m, st2);
+          corpus.push_back(pos.fen());
+          pos.undo_move(m);
+      }
+  }
+
+  deque<Position> positions(corpus.size());
+  deque<StateInfo> states(corpus.size());
+  vector<Position*> all, quiet, checked;
+  vector<vector<Move>> legalMoves;
+
+  for (size_t i = 0; i < corpus.size(); ++i)
+  {
+      Position& pos = positions[i];
+      pos.set(corpus[i], current.is_chess960(), &states[i], th);
+      all.push_back(&pos);
+      (pos.checkers() ? checked : quiet).push_back(&pos);
+
+      legalMoves.emplace_back();
+      for (const auto& m : MoveList<LEGAL>(pos))
+          legalMoves.back().push_back(m);
+  }
+
+  uint64_t sink = 0;
+
+  cerr << "\nMicro benchmark over " << all.size() << " positions ("
+       << checked.size() << " in check)\n" << endl;
+
+  time_kernel("generate<CAPTURES>", sink,     [&]() { return generate_pass<CAPTURES    >(quiet,   sink); });
+  time_kernel("generate<QUIETS>", sink,       [&]() { return generate_pass<QUIETS      >(quiet,   sink); });
+  time_kernel("generate<QUIET_CHECKS>", sink, [&]() { return generate_pass<QUIET_CHECKS>(quiet,   sink); });
+  time_kernel("generate<EVASIONS>", sink,     [&]() { return generate_pass<EVASIONS    >(checked, sink); });
+  time_kernel("generate<NON_EVASIONS>", sink, [&]() { return generate_pass<NON_EVASIONS>(quiet,   sink); });
+  time_kernel("generate<LEGAL>", sink,        [&]() { return generate_pass<LEGAL       >(all,     sink); });
+
+  time_kernel("do_move/undo_move", sink, [&]() {
+      StateInfo st;
+      uint64_t calls = 0;
+      for (size_t i = 0; i < all.size(); ++i)
+          for (Move m : legalMoves[i])
+          {
+              all[i]->do_move(m, st);
+              sink += all[i]->key();
+              all[i]->undo_move(m);
+              ++calls;
+          }
+      return calls;
+  });
+
+  time_kernel("see_ge", sink, [&]() {
+      uint64_t calls = 0;
+      for (size_t i = 0; i < all.size(); ++i)
+          for (Move m : legalMoves[i])
+          {
+              sink += all[i]->see_ge(m);
+              ++calls;
+          }
+      return calls;
+  });
+
+  // Time the evaluation itself rather than the hits of the eval cache, which
+  // would serve every repetition after the first one.
+  size_t evalCacheSize = th->evalCache.size();
+  th->evalCache.init(0);
+
+  time_kernel("Eval::evaluate", sink, [&]() {
+      for (Position* pos : quiet)
+          sink += Eval::evaluate(*pos);
+      return quiet.size();
+  });
+
+  th->evalCache.init(evalCacheSize);
+
+  time_kernel("Pawns::probe", sink, [&]() {
+      for (Position* pos : all)
+          sink += Pawns::probe(*pos)->pawn_asymmetry();
+      return all.size();
+  });
+
+  time_kernel("Material::probe", sink, [&]() {
+      for (Position* pos : all)
+          sink += Material::probe(*pos)->game_phase();
+      return all.size();
+  });
+
+  time_kernel("TT.probe", sink, [&]() {
+      bool found;
+      for (Position* pos : all)
+          sink += TT.probe(pos->key(), found)->depth() + found;
+      return all.size();
+  });
+
+  cerr << "\nChecksum: " << sink << endl;
+}
@@ -19,162 +19,822 @@
 */
 
 #include <algorithm>
+#include <atomic>
 #include <cassert>
-#include <numeric>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
 #include <vector>
 
 #include "bitboard.h"
+#include "misc.h"
 #include "types.h"
 
 namespace {
 
-  // There are 24 possible pawn squares: the first 4 files and ranks from 2 to 7
-  constexpr unsigned MAX_INDEX = 2*24*64*64; // stm * psq * wksq * bksq = 196608
-
-  // Each uint32_t stores results of 32 positions, one per bit
-  uint32_t KPKBitbase[MAX_INDEX / 32];
-
-  // A KPK bitbase index is an integer in [0, IndexMax] range
+  // Bitbases cover the endings with the two kings and up to MaxPieces other
+  // pieces. A bitbase index is an integer in [0, size) range, mapped so that
+  // the white king is always on files A to D, the board being mirrored when
+  // needed, which is possible because no Makruk piece moves asymmetrically
+  // along the ranks.
   //
-  // Information is mapped in a way that minimizes the number of iterations:
+  // bit     0: side to move
+  // bit   1-5: white king square, files A to D only
+  // bit  6-11: black king square
+  // bit 12-17: square of the first piece
+  // bit 18-23: square of the second piece
   //
-  // bit  0- 5: white king square (from SQ_A1 to SQ_H8)
-  // bit  6-11: black king square (from SQ_A1 to SQ_H8)
-  // bit    12: side to move (WHITE or BLACK)
-  // bit 13-14: white pawn file (from FILE_A to FILE_D)
-  // bit 15-17: white pawn RANK_7 - rank (from RANK_7 - RANK_7 to RANK_7 - RANK_2)
-  unsigned index(Color us, Square bksq, Square wksq, Square psq) {
-    return wksq | (bksq << 6) | (us << 12) | (file_of(psq) << 13) | ((RANK_7 - rank_of(psq)) << 15);
-  }
-
-  enum Result {
-    INVALID = 0,
-    UNKNOWN = 1,
-    DRAW    = 2,
-    WIN     = 4
+  // and 6 more bits for each further piece. The tablebase files hold indices
+  // of up to 48 bits, enough for 6 men, but a third piece would take an ending
+  // to 2^30 positions, too many for the 4 bytes per position of solve(), so 5
+  // and 6 man endings are not generated yet: they need a packed solver state.
+  constexpr int MaxPieces = 2;
+
+  // The distance to conversion is stored in 15 bits, as dtc + 1 so that zero
+  // means a draw.
+  constexpr int MaxDtc = 0x7FFE;
+
+  enum Result : uint8_t {
+    UNKNOWN, WIN, LOSS, DRAW
   };
 
-  Result& operator|=(Result& r, Result v) { return r = Result(r | v); }
+  // Setup is a decoded position, with the pieces other than the kings sorted
+  // as in the bitbase they belong to.
+  struct Setup {
 
-  struct KPKPosition {
-    KPKPosition() = default;
-    explicit KPKPosition(unsigned idx);
-    operator Result() const { return result; }
-    Result classify(const std::vector<KPKPosition>& db)
-    { return us == WHITE ? classify<WHITE>(db) : classify<BLACK>(db); }
+    Bitboard occupied() const {
+      Bitboard b = SquareBB[ksq[WHITE]] | ksq[BLACK];
+      for (int i = 0; i < count; ++i)
+          b |= sq[i];
+      return b;
+    }
 
-    template<Color Us> Result classify(const std::vector<KPKPosition>& db);
+    Bitboard pieces(Color c) const {
+      Bitboard b = SquareBB[ksq[c]];
+      for (int i = 0; i < count; ++i)
+          if (color_of(pc[i]) == c)
+              b |= sq[i];
+      return b;
+    }
 
-    Color us;
-    Square ksq[COLOR_NB], psq;
-    Result result;
+    bool attacked(Square s, Color by) const;
+    bool is_ok() const;
+    size_t index() const;
+    void remove(int i);
+    void sort();
+
+    Color stm;
+    Square ksq[COLOR_NB];
+    Piece pc[MaxPieces];
+    Square sq[MaxPieces];
+    int count;
   };
 
-} // namespace
+  // Bitbase stores the positions of an ending that are won or lost for the
+  // side to move, all the others being draws. They are so few, at most a few
+  // thousands for most endings, that they are kept in an open addressed hash
+  // table of their indices, with the result in the 2 lowest bits, instead of
+  // a bit array covering all the positions.
+  struct Bitbase {
+
+    Result probe(size_t idx) const {
+      for (size_t i = hash(idx); entries[i]; i = (i + 1) & mask)
+          if (entries[i] >> 2 == idx)
+              return Result(entries[i] & 3);
+      return DRAW;
+    }
 
+    size_t hash(size_t idx) const { return size_t((idx * 0x9E3779B97F4A7C15ULL) >> 32) & mask; }
+    std::string code() const;
+    bool canonical() const;
+    std::vector<uint64_t> solve() const;
+    void build(const std::vector<uint32_t>& decisive);
+    void generate();
+    bool load(const std::string& fname);
+    void save(const std::string& fname) const;
+    void save_table(const std::string& fname, const std::vector<uint64_t>& decisive) const;
+
+    Piece pc[MaxPieces];
+    int count;
+    size_t size, mask;
+    std::vector<uint32_t> entries;
+  };
 
-bool Bitbases::probe(Square wksq, Square wpsq, Square bksq, Color us) {
+  std::vector<std::unique_ptr<Bitbase>> Store;
+  Bitbase* Tables[PIECE_NB][PIECE_NB];
+  std::string Path;
+  int Loaded, Generated;
 
-  assert(file_of(wpsq) <= FILE_D);
+  // The endings kept in memory for the endgame evaluation, white having the
+  // first pieces. The other ones are only needed to solve them.
+  const char* Codes[] = { "KNK", "KSK", "KMK", "KPK", "KNNK", "KMMK", "KMPK", "KPPK",
+                          "KNKS", "KNKM", "KSKM", "KNKP", "KSKP", "KMKP" };
 
-  unsigned idx = index(us, bksq, wksq, wpsq);
-  return KPKBitbase[idx / 32] & (1 << (idx & 0x1F));
-}
+  Bitbase*& bitbase(const Piece pc[], int count) {
+    return Tables[count > 0 ? pc[0] : NO_PIECE][count > 1 ? pc[1] : NO_PIECE];
+  }
+
+  Bitboard attacks(Piece pc, Square s, Bitboard occupied) {
+
+    switch (type_of(pc))
+    {
+    case PAWN  : return PawnAttacks[color_of(pc)][s];
+    case BISHOP: return BishopAttacks[color_of(pc)][s];
+    case ROOK  : return attacks_bb<ROOK>(s, occupied);
+    default    : return PseudoAttacks[type_of(pc)][s];
+    }
+  }
 
+  bool Setup::attacked(Square s, Color by) const {
 
-void Bitbases::init() {
+    if (PseudoAttacks[KING][ksq[by]] & s)
+        return true;
 
-  std::vector<KPKPosition> db(MAX_INDEX);
-  unsigned idx, repeat = 1;
+    Bitboard occ = occupied();
 
-  // Initialize db with known win / draw positions
-  for (idx = 0; idx < MAX_INDEX; ++idx)
-      db[idx] = KPKPosition(idx);
+    for (int i = 0; i < count; ++i)
+        if (color_of(pc[i]) == by && (attacks(pc[i], sq[i], occ) & s))
+            return true;
 
-  // Iterate through the positions until none of the unknown positions can be
-  // changed to either wins or draws (15 cycles needed).
-  while (repeat)
-      for (repeat = idx = 0; idx < MAX_INDEX; ++idx)
-          repeat |= (db[idx] == UNKNOWN && db[idx].classify(db) != UNKNOWN);
+    return false;
+  }
 
-  // Map 32 results into one KPKBitbase[] entry
-  for (idx = 0; idx < MAX_INDEX; ++idx)
-      if (db[idx] == WIN)
-          KPKBitbase[idx / 32] |= 1 << (idx & 0x1F);
-}
+  // is_ok() checks that no two pieces share a square, that the Bia stand on
+  // the ranks where they can be found in a game and that the side not to
+  // move is not in check.
+  bool Setup::is_ok() const {
 
+    if (distance(ksq[WHITE], ksq[BLACK]) <= 1)
+        return false;
 
-namespace {
+    for (int i = 0; i < count; ++i)
+    {
+        if (sq[i] == ksq[WHITE] || sq[i] == ksq[BLACK])
+            return false;
+
+        for (int j = 0; j < i; ++j)
+            if (sq[i] == sq[j])
+                return false;
+
+        if (   type_of(pc[i]) == PAWN
+            && (   relative_rank(color_of(pc[i]), sq[i]) < RANK_3
+                || relative_rank(color_of(pc[i]), sq[i]) > RANK_5))
+            return false;
+    }
+
+    return !attacked(ksq[~stm], stm);
+  }
+
+  size_t Setup::index() const {
+
+    // Mirror the board so that the white king is on files A to D, keeping
+    // two pieces of the same kind sorted by square.
+    int m = file_of(ksq[WHITE]) > FILE_D ? 7 : 0;
+    size_t s[MaxPieces], idx = 0;
+
+    for (int i = 0; i < count; ++i)
+        s[i] = size_t(sq[i] ^ m);
+
+    if (count == 2 && pc[0] == pc[1] && s[1] < s[0])
+        std::swap(s[0], s[1]);
+
+    for (int i = count - 1; i >= 0; --i)
+        idx = (idx << 6) | s[i];
+
+    Square wk = Square(ksq[WHITE] ^ m);
+
+    idx = (idx << 6) | size_t(ksq[BLACK] ^ m);
+    idx = (idx << 5) | size_t(rank_of(wk) * 4 + file_of(wk));
+    return (idx << 1) | size_t(stm);
+  }
+
+  void Setup::remove(int i) {
+
+    for (--count; i < count; ++i)
+        pc[i] = pc[i + 1], sq[i] = sq[i + 1];
+  }
+
+  void Setup::sort() {
+
+    if (count == 2 && (pc[1] < pc[0] || (pc[1] == pc[0] && sq[1] < sq[0])))
+        std::swap(pc[0], pc[1]), std::swap(sq[0], sq[1]);
+  }
+
+  Setup decode(const Bitbase& bb, size_t idx) {
+
+    Setup s;
+    s.stm = Color(idx & 1);
+    s.ksq[WHITE] = make_square(File((idx >> 1) & 3), Rank((idx >> 3) & 7));
+    s.ksq[BLACK] = Square((idx >> 6) & 63);
+    s.count = bb.count;
+
+    for (int i = 0; i < bb.count; ++i)
+        s.pc[i] = bb.pc[i], s.sq[i] = Square((idx >> (12 + 6 * i)) & 63);
+
+    return s;
+  }
+
+  // probe() returns the result of a position for the side to move, looking in
+  // the color flipped bitbase when only that one exists. Positions without
+  // pieces besides the kings are draws.
+  Result probe(Setup s) {
+
+    s.sort();
 
-  KPKPosition::KPKPosition(unsigned idx) {
-
-    ksq[WHITE] = Square((idx >>  0) & 0x3F);
-    ksq[BLACK] = Square((idx >>  6) & 0x3F);
-    us         = Color ((idx >> 12) & 0x01);
-    psq        = make_square(File((idx >> 13) & 0x3), Rank(RANK_7 - ((idx >> 15) & 0x7)));
-
-    // Check if two pieces are on the same square or if a king can be captured
-    if (   distance(ksq[WHITE], ksq[BLACK]) <= 1
-        || ksq[WHITE] == psq
-        || ksq[BLACK] == psq
-        || (us == WHITE && (PawnAttacks[WHITE][psq] & ksq[BLACK])))
-        result = INVALID;
-
-    // Immediate win if a pawn can be promoted without getting captured
-    else if (   us == WHITE
-             && rank_of(psq) == RANK_7
-             && ksq[us] != psq + NORTH
-             && (    distance(ksq[~us], psq + NORTH) > 1
-                 || (PseudoAttacks[KING][ksq[us]] & (psq + NORTH))))
-        result = WIN;
-
-    // Immediate draw if it is a stalemate or a king captures undefended pawn
-    else if (   us == BLACK
-             && (  !(PseudoAttacks[KING][ksq[us]] & ~(PseudoAttacks[KING][ksq[~us]] | PawnAttacks[~us][psq]))
-                 || (PseudoAttacks[KING][ksq[us]] & psq & ~PseudoAttacks[KING][ksq[~us]])))
-        result = DRAW;
-
-    // Position will be classified later
-    else
-        result = UNKNOWN;
-  }
-
-  template<Color Us>
-  Result KPKPosition::classify(const std::vector<KPKPosition>& db) {
-
-    // White to move: If one move leads to a position classified as WIN, the result
-    // of the current position is WIN. If all moves lead to positions classified
-    // as DRAW, the current position is classified as DRAW, otherwise the current
-    // position is classified as UNKNOWN.
-    //
-    // Black to move: If one move leads to a position classified as DRAW, the result
-    // of the current position is DRAW. If all moves lead to positions classified
-    // as WIN, the position is classified as WIN, otherwise the current position is
-    // classified as UNKNOWN.
-
-    constexpr Color  Them = (Us == WHITE ? BLACK : WHITE);
-    constexpr Result Good = (Us == WHITE ? WIN   : DRAW);
-    constexpr Result Bad  = (Us == WHITE ? DRAW  : WIN);
-
-    Result r = INVALID;
-    Bitboard b = PseudoAttacks[KING][ksq[Us]];
+    if (!s.count)
+        return DRAW;
 
+    Bitbase* bb = bitbase(s.pc, s.count);
+
+    if (!bb)
+    {
+        s.stm = ~s.stm;
+        std::swap(s.ksq[WHITE], s.ksq[BLACK]);
+        s.ksq[WHITE] = ~s.ksq[WHITE];
+        s.ksq[BLACK] = ~s.ksq[BLACK];
+
+        for (int i = 0; i < s.count; ++i)
+            s.pc[i] = ~s.pc[i], s.sq[i] = ~s.sq[i];
+
+        s.sort();
+        bb = bitbase(s.pc, s.count);
+    }
+
+    assert(bb);
+    return bb->probe(s.index());
+  }
+
+  // for_each_move() calls f(child, exit) for each legal move of the side to
+  // move, where exit tells whether the move changes the material, by a capture
+  // or a promotion, so that the child belongs to another bitbase.
+  template<typename F>
+  void for_each_move(const Setup& s, const F& f) {
+
+    Color us = s.stm;
+    Bitboard own = s.pieces(us), occupied = s.occupied();
+
+    auto play = [&](int from, Square to) { // from == -1 for the king
+
+        Setup c = s;
+        bool exit = false;
+
+        for (int i = 0; i < c.count; ++i)
+            if (c.sq[i] == to)
+            {
+                c.remove(i);
+                from -= (i < from);
+                exit = true;
+                break;
+            }
+
+        if (from < 0)
+            c.ksq[us] = to;
+        else
+        {
+            c.sq[from] = to;
+
+            if (type_of(c.pc[from]) == PAWN && relative_rank(us, to) == RANK_6)
+                c.pc[from] = make_piece(us, QUEEN), exit = true;
+        }
+
+        c.stm = ~us;
+
+        if (!c.attacked(c.ksq[us], ~us))
+        {
+            c.sort();
+            f(c, exit);
+        }
+    };
+
+    Bitboard b = PseudoAttacks[KING][s.ksq[us]] & ~own;
+    while (b)
+        play(-1, pop_lsb(&b));
+
+    for (int i = 0; i < s.count; ++i)
+    {
+        if (color_of(s.pc[i]) != us)
+            continue;
+
+        if (type_of(s.pc[i]) == PAWN)
+        {
+            b = PawnAttacks[us][s.sq[i]] & (occupied ^ own ^ s.ksq[~us]);
+            if (!(occupied & (s.sq[i] + pawn_push(us))))
+                b |= s.sq[i] + pawn_push(us);
+        }
+        else
+            b = attacks(s.pc[i], s.sq[i], occupied) & ~own & ~SquareBB[s.ksq[~us]];
+
+        while (b)
+            play(i, pop_lsb(&b));
+    }
+  }
+
+  // for_each_unmove() calls f(parent) for each position from which the side
+  // that just moved could have reached s without capturing or promoting.
+  template<typename F>
+  void for_each_unmove(const Setup& s, const F& f) {
+
+    Color them = ~s.stm;
+    Bitboard occupied = s.occupied();
+
+    auto unplay = [&](int from, Square to) {
+
+        Setup p = s;
+        (from < 0 ? p.ksq[them] : p.sq[from]) = to;
+        p.stm = them;
+        p.sort();
+
+        if (p.is_ok())
+            f(p);
+    };
+
+    Bitboard b = PseudoAttacks[KING][s.ksq[them]] & ~occupied;
     while (b)
-        r |= Us == WHITE ? db[index(Them, ksq[Them]  , pop_lsb(&b), psq)]
-                         : db[index(Them, pop_lsb(&b), ksq[Them]  , psq)];
+        unplay(-1, pop_lsb(&b));
+
+    for (int i = 0; i < s.count; ++i)
+    {
+        if (color_of(s.pc[i]) != them)
+            continue;
+
+        switch (type_of(s.pc[i]))
+        {
+        case PAWN  : b = SquareBB[s.sq[i] - pawn_push(them)]; break;
+        case BISHOP: b = BishopAttacks[~them][s.sq[i]]; break;
+        default    : b = attacks(s.pc[i], s.sq[i], occupied);
+        }
+
+        b &= ~occupied;
+        while (b)
+            unplay(i, pop_lsb(&b));
+    }
+  }
+
+  // run() calls f(begin, end) on all the hardware threads, splitting the range
+  // [0, size) among them.
+  template<typename F>
+  void run(size_t size, const F& f) {
+
+    size_t n = std::max(1U, std::thread::hardware_concurrency());
+    std::vector<std::thread> threads;
 
-    if (Us == WHITE)
+    for (size_t t = 1; t < n; ++t)
+        threads.emplace_back(f, size * t / n, size * (t + 1) / n);
+
+    f(0, size / n);
+
+    for (std::thread& th : threads)
+        th.join();
+  }
+
+  // solve() computes the ending by retrograde analysis and returns its won and
+  // lost positions, as index << 16 | win << 15 | (dtc + 1), where dtc is the number
+  // of plies to the next capture, promotion or mate with best play. Firstly each
+  // position is given the number of its legal moves staying in the ending, and
+  // is solved when it is a mate, a stalemate or when a capture or a promotion
+  // leads to a lost or drawn position, looked up in the smaller bitbases. Then,
+  // one ply at a time, positions from which a move reaches a loss become wins,
+  // and positions whose moves all reach wins become losses. The positions that
+  // are never solved are draws.
+  std::vector<uint64_t> Bitbase::solve() const {
+
+    std::vector<std::atomic<uint8_t>> result(size), moves(size);
+    std::vector<uint16_t> dtc(size);
+    std::vector<std::vector<size_t>> frontier(std::thread::hardware_concurrency() + 1);
+    std::vector<size_t> current, next;
+    std::atomic<size_t> slot(0);
+
+    run(size, [&](size_t begin, size_t end) {
+
+        std::vector<size_t>& solved = frontier[slot++];
+
+        for (size_t idx = begin; idx < end; ++idx)
+        {
+            Setup s = decode(*this, idx);
+
+            if (!s.is_ok() || s.index() != idx) // Including unsorted duplicates
+            {
+                result[idx] = DRAW;
+                continue;
+            }
+
+            int legal = 0, stay = 0;
+            Result r = UNKNOWN;
+
+            for_each_move(s, [&](const Setup& c, bool exit) {
+                ++legal;
+                if (!exit)
+                    ++stay;
+                else
+                {
+                    Result cr = ::probe(c);
+                    r = cr == LOSS || r == WIN ? WIN : cr == DRAW ? DRAW : r;
+                }
+            });
+
+            if (!legal) // Mate or stalemate, which is a draw in Makruk
+                r = s.attacked(s.ksq[s.stm], ~s.stm) ? LOSS : DRAW;
+
+            else if (r == UNKNOWN && !stay)
+                r = LOSS;
+
+            // A drawing capture or promotion rules out a loss, so the counter
+            // of such positions can never reach zero.
+            moves[idx] = uint8_t(r == DRAW ? 255 : stay);
+            result[idx] = uint8_t(r == DRAW && stay ? UNKNOWN : r);
+            dtc[idx] = legal ? 1 : 0;
+
+            if (r == WIN || r == LOSS)
+                solved.push_back(idx);
+        }
+    });
+
+    for (auto& v : frontier)
     {
-        if (rank_of(psq) < RANK_7)      // Single push
-            r |= db[index(Them, ksq[Them], ksq[Us], psq + NORTH)];
+        for (size_t idx : v)
+            (dtc[idx] ? next : current).push_back(idx);
+        v.clear();
+    }
 
-        if (   rank_of(psq) == RANK_2   // Double push
-            && psq + NORTH != ksq[Us]
-            && psq + NORTH != ksq[Them])
-            r |= db[index(Them, ksq[Them], ksq[Us], psq + NORTH + NORTH)];
+    for (int ply = 0; !current.empty() || !next.empty(); ++ply)
+    {
+        if (ply + 1 > MaxDtc)
+        {
+            std::cerr << "Distance to conversion of " << code() << " beyond "
+                      << MaxDtc << " plies" << std::endl;
+            std::exit(EXIT_FAILURE);
+        }
+
+        slot = 0;
+        run(current.size(), [&](size_t begin, size_t end) {
+
+            std::vector<size_t>& solved = frontier[slot++];
+
+            for (size_t k = begin; k < end; ++k)
+            {
+                Result r = Result(result[current[k]].load());
+
+                for_each_unmove(decode(*this, current[k]), [&](const Setup& p) {
+
+                    size_t idx = p.index();
+                    uint8_t unknown = UNKNOWN;
+
+                    if (r == LOSS)
+                    {
+                        if (result[idx].compare_exchange_strong(unknown, WIN))
+                            dtc[idx] = uint16_t(ply + 1), solved.push_back(idx);
+                    }
+                    else if (result[idx] == UNKNOWN && moves[idx].fetch_sub(1) == 1)
+                    {
+                        result[idx] = LOSS;
+                        dtc[idx] = uint16_t(ply + 1);
+                        solved.push_back(idx);
+                    }
+                });
+            }
+        });
+
+        for (auto& v : frontier)
+            next.insert(next.end(), v.begin(), v.end()), v.clear();
+
+        current.swap(next);
+        next.clear();
     }
 
-    return result = r & Good  ? Good  : r & UNKNOWN ? UNKNOWN : Bad;
+    std::vector<uint64_t> decisive;
+
+    for (size_t idx = 0; idx < size; ++idx)
+        if (result[idx] == WIN || result[idx] == LOSS)
+            decisive.push_back(uint64_t(idx) << 16 | (result[idx] == WIN) << 15 | (dtc[idx] + 1));
+
+    return decisive;
+  }
+
+  // generate() computes the bitbase and saves the ending in the tablebase
+  // format with the distances to conversion.
+  void Bitbase::generate() {
+
+    std::vector<uint64_t> decisive = solve();
+    std::vector<uint32_t> results;
+
+    if (canonical())
+        save_table(Path + "/" + code() + ".mtb", decisive);
+
+    for (uint64_t e : decisive)
+        results.push_back(uint32_t((e >> 16) << 2 | (e & 0x8000 ? WIN : LOSS)));
+
+    build(results);
+  }
+
+  // build() fills the hash table with the given won and lost positions, keeping
+  // it at most half full so that the probes stay short.
+  void Bitbase::build(const std::vector<uint32_t>& decisive) {
+
+    size_t n = 2;
+    while (n < 2 * decisive.size())
+        n *= 2;
+
+    mask = n - 1;
+    entries.assign(n, 0);
+
+    for (uint32_t e : decisive)
+    {
+        size_t i = hash(e >> 2);
+        while (entries[i])
+            i = (i + 1) & mask;
+        entries[i] = e;
+    }
+  }
+
+  // code() returns the name of the ending, like "KNKP", white pieces first
+  std::string Bitbase::code() const {
+
+    std::string s;
+    for (Color c = WHITE; c <= BLACK; ++c)
+    {
+        s += 'K';
+        for (int i = count - 1; i >= 0; --i) // Strongest piece first
+            if (color_of(pc[i]) == c)
+                s += " PMSNRK"[type_of(pc[i])];
+    }
+    return s;
+  }
+
+  // canonical() tells whether the ending is the one of the pair of color flipped
+  // endings that is saved as a tablebase: the one where white has the pieces,
+  // or the strongest piece when both sides have one.
+  bool Bitbase::canonical() const {
+
+    return color_of(pc[0]) == WHITE
+        && (count == 1 || color_of(pc[1]) == WHITE || type_of(pc[0]) >= type_of(pc[1]));
+  }
+
+  // A bitbase file is a sequence of little endian 32 bit integers: Magic, the
+  // number of positions of the ending, the number of won or lost ones and then
+  // these, as stored in the hash table.
+  //
+  // A tablebase file, read by the Syzygy prober, starts with a 16 byte header:
+  // TableMagic, that is "MTB" and the format version, then one byte for the
+  // number of men of the ending, one byte set to Dense or Sparse, two zero bytes
+  // and the number of entries as a 64 bit integer. A sparse table has one entry
+  // for each won or lost position, sorted, as returned by solve(). When these
+  // are more than a quarter of the positions, the table is dense instead and
+  // has a 16 bit entry for each position, the low bits of its solve() entry or
+  // zero for a draw.
+  constexpr uint32_t Magic = 0x4D4B4201;
+  constexpr uint32_t TableMagic = 0x0242544D; // "MTB\x02"
+  constexpr uint32_t Sparse = 0, Dense = 1;
+
+  template<typename T>
+  void write(std::ofstream& file, const std::vector<T>& v) {
+
+    for (T e : v)
+        for (size_t i = 0; i < sizeof(T); ++i)
+            file.put(char(e >> (8 * i)));
+  }
+
+  bool Bitbase::load(const std::string& fname) {
+
+    std::ifstream file(fname, std::ios::binary);
+    std::vector<uint32_t> v;
+    unsigned char b[4];
+
+    while (file.read((char*)b, 4))
+        v.push_back(b[0] | b[1] << 8 | b[2] << 16 | uint32_t(b[3]) << 24);
+
+    if (v.size() < 3 || v[0] != Magic || v[1] != size || v[2] != v.size() - 3)
+        return false;
+
+    build(std::vector<uint32_t>(v.begin() + 3, v.end()));
+    return true;
+  }
+
+  void Bitbase::save(const std::string& fname) const {
+
+    std::vector<uint32_t> v = { Magic, uint32_t(size), 0 };
+
+    for (uint32_t e : entries)
+        if (e)
+            v.push_back(e);
+
+    std::sort(v.begin() + 3, v.end());
+    v[2] = uint32_t(v.size() - 3);
+
+    std::ofstream file(fname, std::ios::binary);
+    write(file, v);
+  }
+
+  void Bitbase::save_table(const std::string& fname, const std::vector<uint64_t>& decisive) const {
+
+    std::ofstream file(fname, std::ios::binary);
+    uint32_t men = uint32_t(count + 2);
+
+    if (4 * decisive.size() <= size)
+    {
+        write<uint32_t>(file, { TableMagic, men | Sparse << 8 });
+        write<uint64_t>(file, { decisive.size() });
+        write(file, decisive);
+        return;
+    }
+
+    std::vector<uint16_t> values(size);
+
+    for (uint64_t e : decisive)
+        values[e >> 16] = uint16_t(e);
+
+    write<uint32_t>(file, { TableMagic, men | Dense << 8 });
+    write<uint64_t>(file, { size });
+    write(file, values);
+  }
+
+  void clear() {
+
+    Store.clear();
+    std::fill(&Tables[0][0], &Tables[0][0] + PIECE_NB * PIECE_NB, nullptr);
+    Loaded = Generated = 0;
+  }
+
+  // create() adds an empty bitbase for the given pieces, sorted
+  Bitbase* create(const Piece pc[], int count) {
+
+    Store.emplace_back(new Bitbase());
+    Bitbase* bb = bitbase(pc, count) = Store.back().get();
+    std::copy(pc, pc + count, bb->pc);
+    bb->count = count;
+    bb->size = size_t(2 * 32 * 64) << (6 * count);
+    return bb;
+  }
+
+  // parse() sets the sorted pieces of the ending of the given code and returns
+  // their number.
+  int parse(const char* code, Piece pc[]) {
+
+    int count = 0;
+    Color c = BLACK;
+
+    for (const char* p = code; *p; ++p)
+        if (*p == 'K')
+            c = ~c;
+        else
+            pc[count++] = make_piece(c, PieceType(std::string(" PMSNRK").find(*p)));
+
+    std::sort(pc, pc + count);
+    return count;
+  }
+
+  // generated() returns the bitbase of the given pieces, sorted, solving it
+  // the first time together with the bitbases it depends on.
+  Bitbase* generated(const Piece pc[], int count) {
+
+    if (Bitbase* bb = bitbase(pc, count))
+        return bb;
+
+    // Get first the bitbases reached by a capture or a promotion
+    for (int i = 0; i < count; ++i)
+    {
+        Setup s;
+        s.count = count;
+        std::copy(pc, pc + count, s.pc);
+        std::fill(s.sq, s.sq + count, SQ_A1);
+
+        if (type_of(pc[i]) == PAWN)
+        {
+            Setup p = s;
+            p.pc[i] = make_piece(color_of(pc[i]), QUEEN);
+            p.sort();
+            generated(p.pc, p.count);
+        }
+
+        s.remove(i);
+        if (s.count)
+            generated(s.pc, s.count);
+    }
+
+    Bitbase* bb = create(pc, count);
+    bb->generate();
+    ++Generated;
+    return bb;
   }
 
 } // namespace
+
+
+/// Bitbases::init() reads the bitbases of the Makruk endings listed in Codes
+/// from the *.mbb files of the given directory, as written by generate(). The
+/// endings whose file is missing or invalid are left out, so that the endgame
+/// evaluation does without them. No bitbase is available when the path is
+/// empty.
+
+void Bitbases::init(const std::string& path) {
+
+  clear();
+
+  if (path.empty() || path == "<empty>")
+      return;
+
+  for (const char* code : Codes)
+  {
+      Piece pc[MaxPieces];
+      int count = parse(code, pc);
+      Bitbase* bb = create(pc, count);
+
+      if (bb->load(path + "/" + bb->code() + ".mbb"))
+          ++Loaded;
+      else
+          bitbase(pc, count) = nullptr, Store.pop_back();
+  }
+
+  sync_cout << "info string Bitbases: " << Loaded << " of " << sizeof(Codes) / sizeof(Codes[0])
+            << " loaded" << sync_endl;
+}
+
+
+/// Bitbases::probe() looks up a position given by the squares of the kings and
+/// of one or two other pieces, pc2 being NO_PIECE when there is only one. When
+/// the bitbase of these pieces is available, it sets result to 1 if the side to
+/// move wins, to -1 if it loses and to 0 for a draw, and returns true.
+
+bool Bitbases::probe(Color stm, Square wksq, Square bksq, Piece pc1, Square s1,
+                     Piece pc2, Square s2, int& result) {
+
+  Setup s;
+  s.stm = stm;
+  s.ksq[WHITE] = wksq;
+  s.ksq[BLACK] = bksq;
+  s.pc[0] = pc1, s.sq[0] = s1;
+  s.pc[1] = pc2, s.sq[1] = s2;
+  s.count = pc2 == NO_PIECE ? 1 : 2;
+  s.sort();
+
+  Piece flipped[MaxPieces] = { ~s.pc[0], ~s.pc[1] };
+  if (s.count == 2 && flipped[1] < flipped[0])
+      std::swap(flipped[0], flipped[1]);
+
+  if (!bitbase(s.pc, s.count) && !bitbase(flipped, s.count))
+      return false;
+
+  Result r = ::probe(s);
+  result = r == WIN ? 1 : r == LOSS ? -1 : 0;
+  return true;
+}
+
+
+/// Bitbases::generate() solves all the endings with up to two pieces besides
+/// the kings and writes them to the given directory as tablebases, which also
+/// hold the distance to conversion and are probed by the Syzygy code, along
+/// with the bitbase files read by init(). It takes about three minutes on a
+/// single core.
+
+void Bitbases::generate(const std::string& path) {
+
+  TimePoint elapsed = now();
+
+  clear();
+  Path = path;
+
+  for (PieceType p1 = PAWN; p1 < KING; ++p1)
+  {
+      Piece pc[] = { make_piece(WHITE, p1), NO_PIECE };
+      generated(pc, 1);
+
+      for (PieceType p2 = PAWN; p2 <= p1; ++p2)
+      {
+          Piece same[] = { make_piece(WHITE, p2), make_piece(WHITE, p1) };
+          Piece opposite[] = { make_piece(WHITE, p1), make_piece(BLACK, p2) };
+          generated(same, 2);
+          generated(opposite, 2);
+      }
+  }
+
+  for (const char* code : Codes)
+  {
+      Piece pc[MaxPieces];
+      int count = parse(code, pc);
+      const Bitbase* bb = bitbase(pc, count);
+      bb->save(Path + "/" + bb->code() + ".mbb");
+  }
+
+  sync_cout << "info string Generated " << Generated << " endings in "
+            << now() - elapsed << "ms" << sync_endl;
+}
+
+
+/// Bitbases::index() returns the index of a position in the bitbase or in the
+/// tablebase of its pieces, where pc2 is NO_PIECE when there is only one.
+
+size_t Bitbases::index(Color stm, Square wksq, Square bksq, Piece pc1, Square s1,
+                       Piece pc2, Square s2) {
+
+  Setup s;
+  s.stm = stm;
+  s.ksq[WHITE] = wksq;
+  s.ksq[BLACK] = bksq;
+  s.pc[0] = pc1, s.sq[0] = s1;
+  s.pc[1] = pc2, s.sq[1] = s2;
+  s.count = pc2 == NO_PIECE ? 1 : 2;
+  s.sort();
+  return s.index();
+}
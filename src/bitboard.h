@@ -27,8 +27,12 @@
 
 namespace Bitbases {
 
-void init();
-bool probe(Square wksq, Square wpsq, Square bksq, Color us);
+void init(const std::string& path);
+void generate(const std::string& path);
+bool probe(Color stm, Square wksq, Square bksq, Piece pc1, Square s1,
+           Piece pc2, Square s2, int& result);
+size_t index(Color stm, Square wksq, Square bksq, Piece pc1, Square s1,
+             Piece pc2, Square s2);
 
 }
 
@@ -92,12 +92,53 @@ namespace {
   }
 #endif
 
+  // Returns the value of a position from the bitbases, as seen by the side to
+  // move, or a draw when they are not available. Won positions are scored like
+  // KX vs K to make progress towards the mate.
+  Value probe_bitbases(const Position& pos) {
+
+    Piece pc[2] = { NO_PIECE, NO_PIECE };
+    Square sq[2] = { SQ_NONE, SQ_NONE };
+    Bitboard b = pos.pieces() ^ pos.pieces(KING);
+    int n = 0, result;
+
+    assert(popcount(b) <= 2);
+
+    while (b)
+    {
+        sq[n] = pop_lsb(&b);
+        pc[n] = pos.piece_on(sq[n]);
+        ++n;
+    }
+
+    if (   !Bitbases::probe(pos.side_to_move(), pos.square<KING>(WHITE), pos.square<KING>(BLACK),
+                            pc[0], sq[0], pc[1], sq[1], result)
+        || !result)
+        return VALUE_DRAW;
+
+    Color loser = result > 0 ? ~pos.side_to_move() : pos.side_to_move();
+    Square winnerKSq = pos.square<KING>(~loser);
+    Square loserKSq = pos.square<KING>(loser);
+
+    Value value =  VALUE_KNOWN_WIN
+                 + PushToEdges[loserKSq]
+                 + PushClose[distance(winnerKSq, loserKSq)];
+
+    return result > 0 ? value : -value;
+  }
+
 } // namespace
 
 
-/// Endgames members definitions
+namespace Endgames {
+
+std::pair<Registry<Value>, Registry<ScaleFactor>> registries;
 
-Endgames::Endgames() {
+
+/// Endgames::init() registers the endgame functions that are looked up by
+/// material key.
+
+void init() {
 
   add<KNNK>("KNNK");
   add<KQQK>("KMMK");
@@ -118,6 +159,8 @@ Endgames::Endgames() {
   add<KRKN>("KRKN");
 }
 
+} // namespace Endgames
+
 
 /// Mate with KX vs K. This function is used to evaluate positions with
 /// king and plenty of material vs a lone king. It simply gives the
@@ -446,31 +489,31 @@ Value Endgame<KRKN>::operator()(const Position& pos) const {
 }
 
 
-/// Some cases of trivial draws
-template<> Value Endgame<KNNK>::operator()(const Position&) const { return VALUE_DRAW; }
+/// Endings with up to two pieces besides the kings, solved by the bitbases
+template<> Value Endgame<KNNK>::operator()(const Position& pos) const { return probe_bitbases(pos); }
 
-template<> Value Endgame<KQQK>::operator()(const Position&) const { return VALUE_DRAW; }
+template<> Value Endgame<KQQK>::operator()(const Position& pos) const { return probe_bitbases(pos); }
 
-template<> Value Endgame<KQPK>::operator()(const Position&) const { return VALUE_DRAW; }
+template<> Value Endgame<KQPK>::operator()(const Position& pos) const { return probe_bitbases(pos); }
 
-template<> Value Endgame<KPPK>::operator()(const Position&) const { return VALUE_DRAW; }
+template<> Value Endgame<KPPK>::operator()(const Position& pos) const { return probe_bitbases(pos); }
 
-template<> Value Endgame<KNK>::operator()(const Position&) const { return VALUE_DRAW; }
+template<> Value Endgame<KNK>::operator()(const Position& pos) const { return probe_bitbases(pos); }
 
-template<> Value Endgame<KBK>::operator()(const Position&) const { return VALUE_DRAW; }
+template<> Value Endgame<KBK>::operator()(const Position& pos) const { return probe_bitbases(pos); }
 
-template<> Value Endgame<KQK>::operator()(const Position&) const { return VALUE_DRAW; }
+template<> Value Endgame<KQK>::operator()(const Position& pos) const { return probe_bitbases(pos); }
 
-template<> Value Endgame<KPK>::operator()(const Position&) const { return VALUE_DRAW; }
+template<> Value Endgame<KPK>::operator()(const Position& pos) const { return probe_bitbases(pos); }
 
-template<> Value Endgame<KNKB>::operator()(const Position&) const { return VALUE_DRAW; }
+template<> Value Endgame<KNKB>::operator()(const Position& pos) const { return probe_bitbases(pos); }
 
-template<> Value Endgame<KNKQ>::operator()(const Position&) const { return VALUE_DRAW; }
+template<> Value Endgame<KNKQ>::operator()(const Position& pos) const { return probe_bitbases(pos); }
 
-template<> Value Endgame<KBKQ>::operator()(const Position&) const { return VALUE_DRAW; }
+template<> Value Endgame<KBKQ>::operator()(const Position& pos) const { return probe_bitbases(pos); }
 
-template<> Value Endgame<KNKP>::operator()(const Position&) const { return VALUE_DRAW; }
+template<> Value Endgame<KNKP>::operator()(const Position& pos) const { return probe_bitbases(pos); }
 
-template<> Value Endgame<KBKP>::operator()(const Position&) const { return VALUE_DRAW; }
+template<> Value Endgame<KBKP>::operator()(const Position& pos) const { return probe_bitbases(pos); }
 
-template<> Value Endgame<KQKP>::operator()(const Position&) const { return VALUE_DRAW; }
+template<> Value Endgame<KQKP>::operator()(const Position& pos) const { return probe_bitbases(pos); }
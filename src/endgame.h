@@ -21,7 +21,7 @@
 #ifndef ENDGAME_H_INCLUDED
 #define ENDGAME_H_INCLUDED
 
-#include <map>
+#include <cassert>
 #include <memory>
 #include <string>
 #include <type_traits>
@@ -94,37 +94,64 @@ struct Endgame : public EndgameBase<T> {
 };
 
 
-/// The Endgames class stores the pointers to endgame evaluation and scaling
-/// base objects in two std::map. We use polymorphism to invoke the actual
-/// endgame function by calling its virtual operator().
+/// The Endgames namespace holds the process-wide registry of the endgame
+/// evaluation and scaling functions, looked up by material key. It is filled
+/// once by init() at startup and is read-only afterwards, so it is shared by
+/// all the threads. Each type of function has a small open-addressed table
+/// with linear probing, where a null pointer marks an empty slot. We use
+/// polymorphism to invoke the actual endgame function by calling its virtual
+/// operator().
 
-class Endgames {
+namespace Endgames {
 
-  template<typename T> using Ptr = std::unique_ptr<EndgameBase<T>>;
-  template<typename T> using Map = std::map<Key, Ptr<T>>;
+  template<typename T>
+  struct Registry {
+
+    static constexpr size_t Size = 64; // Power of 2, at least twice the entries
+
+    void insert(Key key, EndgameBase<T>* f) {
+      assert(count < Size / 2); // Otherwise grow Size, the loop below needs a free slot
+      ++count;
+      size_t i = key & (Size - 1);
+      while (functions[i])
+          i = (i + 1) & (Size - 1);
+      keys[i] = key;
+      functions[i].reset(f);
+    }
+
+    EndgameBase<T>* probe(Key key) const {
+      for (size_t i = key & (Size - 1); functions[i]; i = (i + 1) & (Size - 1))
+          if (keys[i] == key)
+              return functions[i].get();
+      return nullptr;
+    }
+
+    Key keys[Size];
+    std::unique_ptr<EndgameBase<T>> functions[Size];
+    size_t count = 0;
+  };
+
+  extern std::pair<Registry<Value>, Registry<ScaleFactor>> registries;
 
   template<typename T>
-  Map<T>& map() {
-    return std::get<std::is_same<T, ScaleFactor>::value>(maps);
+  Registry<T>& registry() {
+    return std::get<std::is_same<T, ScaleFactor>::value>(registries);
   }
 
-  template<EndgameCode E, typename T = eg_type<E>, typename P = Ptr<T>>
+  template<EndgameCode E, typename T = eg_type<E>>
   void add(const std::string& code) {
 
     StateInfo st;
-    map<T>()[Position().set(code, WHITE, &st).material_key()] = P(new Endgame<E>(WHITE));
-    map<T>()[Position().set(code, BLACK, &st).material_key()] = P(new Endgame<E>(BLACK));
+    registry<T>().insert(Position().set(code, WHITE, &st).material_key(), new Endgame<E>(WHITE));
+    registry<T>().insert(Position().set(code, BLACK, &st).material_key(), new Endgame<E>(BLACK));
   }
 
-  std::pair<Map<Value>, Map<ScaleFactor>> maps;
-
-public:
-  Endgames();
+  void init();
 
   template<typename T>
   EndgameBase<T>* probe(Key key) {
-    return map<T>().count(key) ? map<T>()[key].get() : nullptr;
+    return registry<T>().probe(key);
   }
-};
+}
 
 #endif // #ifndef ENDGAME_H_INCLUDED
@@ -22,13 +22,17 @@
 #include <cassert>
 #include <cstring>   // For std::memset
 #include <iomanip>
+#include <iostream>
 #include <sstream>
 
 #include "bitboard.h"
 #include "evaluate.h"
 #include "material.h"
+#include "misc.h"
+#include "nnue.h"
 #include "pawns.h"
 #include "thread.h"
+#include "uci.h"
 
 namespace Trace {
 
@@ -822,7 +826,74 @@ namespace {
 /// evaluation of the position from the point of view of the side to move.
 
 Value Eval::evaluate(const Position& pos) {
-  return Evaluation<NO_TRACE>(pos).value();
+
+  auto compute = [&]() {
+
+      if (useNNUE)
+      {
+          // Specialized endgame evaluation functions are still used with NNUE
+          Material::Entry* me = Material::probe(pos);
+          if (me->specialized_eval_exists())
+              return me->evaluate(pos);
+
+          return NNUE::evaluate(pos) + Tempo;
+      }
+
+      return Evaluation<NO_TRACE>(pos).value();
+  };
+
+  Thread* th = pos.this_thread();
+
+  if (!th->evalCache.size())
+      return compute();
+
+  // The evaluation depends on the dynamic contempt of the thread and on the
+  // evaluation function in use, so they are part of the key.
+  Key key = pos.key() ^ (Key(th->contempt) * 0x9E3779B97F4A7C15ULL) ^ Key(useNNUE);
+  CacheEntry* e = th->evalCache[key];
+
+  th->evalCache.stats.probes++;
+
+  if (e->key32 == uint32_t(key >> 32))
+  {
+      th->evalCache.stats.hits++;
+      return Value(e->value);
+  }
+
+  e->key32 = uint32_t(key >> 32);
+  e->value = compute();
+
+  return Value(e->value);
+}
+
+
+/// init_NNUE() follows the "Use NNUE" and "EvalFile" options, loading the
+/// network when needed. If it cannot be loaded, the classical evaluation is
+/// used instead.
+
+bool Eval::useNNUE;
+
+void Eval::init_NNUE() {
+
+  static std::string loadedFile;
+  std::string evalFile = Options["EvalFile"];
+
+  useNNUE = Options["Use NNUE"];
+
+  if (!useNNUE)
+      return;
+
+  if (evalFile != loadedFile)
+      loadedFile = NNUE::load(evalFile) ? evalFile : "";
+
+  if (loadedFile.empty())
+  {
+      useNNUE = false;
+      sync_cout << "info string Could not load network file " << evalFile
+                << ", using the classical evaluation" << sync_endl;
+  }
+  else
+      sync_cout << "info string NNUE evaluation using " << evalFile << sync_endl;
 }
 
 
@@ -863,5 +934,13 @@ std::string Eval::trace(const Position& pos) {
 
   ss << "\nTotal evaluation: " << to_cp(v) << " (white side)\n";
 
+  if (useNNUE)
+  {
+      v = NNUE::evaluate(pos);
+      v = pos.side_to_move() == WHITE ? v : -v;
+
+      ss << "NNUE evaluation:  " << to_cp(v) << " (white side)\n";
+  }
+
   return ss.str();
 }
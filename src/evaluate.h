@@ -24,6 +24,7 @@
 #include <atomic>
 #include <string>
 
+#include "misc.h"
 #include "types.h"
 
 class Position;
@@ -32,9 +33,23 @@ namespace Eval {
 
 constexpr Value Tempo = Value(20); // Must be visible to search
 
+extern bool useNNUE;
+
+/// Cache is a per-thread table of static evaluations, so that positions whose
+/// evaluation is not found in the transposition table are not evaluated again.
+/// Its size is set by the "Eval Cache" option, in MB per thread.
+
+struct CacheEntry {
+  uint32_t key32;
+  int32_t value;
+};
+
+typedef HashTable<CacheEntry, 0> Cache;
+
 std::string trace(const Position& pos);
 
 Value evaluate(const Position& pos);
+void init_NNUE();
 }
 
 #endif // #ifndef EVALUATE_H_INCLUDED
@@ -40,7 +40,9 @@ int main(int argc, char* argv[]) {
   PSQT::init();
   Bitboards::init();
   Position::init();
-  Bitbases::init();
+  Bitbases::init(Options["BitbasePath"]);
+  Endgames::init();
+  Material::init();
   Search::init();
   Pawns::init();
   Tablebases::init(Options["SyzygyPath"]); // After Bitboards are set
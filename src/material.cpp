@@ -21,9 +21,10 @@
 #include <algorithm> // For std::min
 #include <cassert>
 #include <cstring>   // For std::memset
+#include <initializer_list>
+#include <string>
 
 #include "material.h"
-#include "thread.h"
 
 using namespace std;
 
@@ -62,100 +63,63 @@ namespace {
   Endgame<KXKB>    EvaluateKXKB[]    = { Endgame<KXKB>(WHITE),    Endgame<KXKB>(BLACK) };
   Endgame<KXKN>    EvaluateKXKN[]    = { Endgame<KXKN>(WHITE),    Endgame<KXKN>(BLACK) };
   Endgame<KXKR>    EvaluateKXKR[]    = { Endgame<KXKR>(WHITE),    Endgame<KXKR>(BLACK) };
-  
-  // Helper used to detect a given material distribution
-  bool is_KXK(const Position& pos, Color us) {
-    return  !more_than_one(pos.pieces(~us))
-          && (pos.count<PAWN>(us) || !pos.count<PAWN>(us)) //pr0rp
-          && pos.non_pawn_material(us) >= BishopValueMg + QueenValueMg;
-  }
 
-  bool is_KQsPsK(const Position& pos, Color us) {
-    return   (pos.count<QUEEN >(us) || pos.count<PAWN>(us))
-          && !pos.count<ROOK  >(us)
-          && !pos.count<BISHOP>(us)
-          && !pos.count<KNIGHT>(us)
-          && (pos.count<PAWN>(~us) || !pos.count<PAWN>(~us))
-          && !pos.count<ROOK>(~us)
-          && !pos.count<BISHOP>(~us)
-          && !pos.count<KNIGHT>(~us)
-          && !pos.count<QUEEN>(~us);
+  // The table covers every configuration with up to 8 pawns, 2 queens and 2
+  // pieces of each other type per side. Two queens count as a queen pair when
+  // they stand on squares of different colors, which is part of the imbalance.
+  // Configurations with more promoted queens are computed on the fly.
+  constexpr int MaxPawns = 8, MaxQueens = 2, MaxPieces = 2;
+  constexpr int QueenStates = MaxQueens + 2; // 0, 1, 2 or a pair of queens
+  constexpr int SideNb = QueenStates * (MaxPawns + 1) * (MaxPieces + 1) * (MaxPieces + 1) * (MaxPieces + 1);
+
+  std::vector<Material::Entry> Table;
+
+  // Piece counts of a material configuration, indexed like pieceCount in Position
+  // except that NO_PIECE_TYPE stands for the queen pair.
+  typedef int Counts[COLOR_NB][PIECE_TYPE_NB];
+
+  Value non_pawn_material(const Counts& cnt, Color c) {
+    return  cnt[c][QUEEN ] * QueenValueMg  + cnt[c][BISHOP] * BishopValueMg
+          + cnt[c][KNIGHT] * KnightValueMg + cnt[c][ROOK  ] * RookValueMg;
   }
 
-  bool is_KXKP(const Position& pos, Color us) {
-    return   !pos.count<PAWN>(us)
-          && (pos.count<ROOK>(us) || !pos.count<ROOK>(us))
-          && (pos.count<KNIGHT>(us) || !pos.count<KNIGHT>(us))
-          && (pos.count<BISHOP>(us) || !pos.count<BISHOP>(us))
-          && (pos.count<QUEEN>(us) || !pos.count<QUEEN>(us))
-          && pos.count<PAWN>(~us) == 1
-          && !pos.count<ROOK>(~us)
-          && !pos.count<KNIGHT>(~us)
-          && !pos.count<BISHOP>(~us)
-          && !pos.count<QUEEN>(~us)
-          && pos.non_pawn_material(us) >= BishopValueEg + QueenValueEg;
+  // Helpers used to detect a given material distribution: lone() tells whether
+  // c has only its king and n pieces of type pt.
+  bool lone(const Counts& cnt, Color c, PieceType pt = NO_PIECE_TYPE, int n = 0) {
+    for (PieceType p = PAWN; p <= ROOK; ++p)
+        if (cnt[c][p] != (p == pt ? n : 0))
+            return false;
+    return true;
   }
 
-  bool is_KXKQ(const Position& pos, Color us) {
-    return   !pos.count<PAWN>(us)
-          && (pos.count<ROOK>(us) || !pos.count<ROOK>(us))
-          && (pos.count<KNIGHT>(us) || !pos.count<KNIGHT>(us))
-          && (pos.count<BISHOP>(us) || !pos.count<BISHOP>(us))
-          && (pos.count<QUEEN>(us) || !pos.count<QUEEN>(us))
-          && !pos.count<PAWN>(~us)
-          && !pos.count<ROOK>(~us)
-          && !pos.count<KNIGHT>(~us)
-          && !pos.count<BISHOP>(~us)
-          && pos.count<QUEEN>(~us) == 1
-          && pos.non_pawn_material(us) - pos.non_pawn_material(~us) >= BishopValueEg + QueenValueEg;
+  bool is_KXK(const Counts& cnt, Color us) {
+    return   lone(cnt, ~us)
+          && non_pawn_material(cnt, us) >= BishopValueMg + QueenValueMg;
   }
 
-  bool is_KXKB(const Position& pos, Color us) {
-    return   !pos.count<PAWN>(us)
-          && (pos.count<ROOK>(us) || !pos.count<ROOK>(us))
-          && (pos.count<KNIGHT>(us) || !pos.count<KNIGHT>(us))
-          && (pos.count<BISHOP>(us) || !pos.count<BISHOP>(us))
-          && (pos.count<QUEEN>(us) || !pos.count<QUEEN>(us))
-          && !pos.count<PAWN>(~us)
-          && !pos.count<ROOK>(~us)
-          && !pos.count<KNIGHT>(~us)
-          && pos.count<BISHOP>(~us) == 1
-          && !pos.count<QUEEN>(~us)
-          && pos.non_pawn_material(us) - pos.non_pawn_material(~us) >= BishopValueEg + QueenValueEg;
+  bool is_KQsPsK(const Counts& cnt, Color us) {
+    return   (cnt[us][QUEEN] || cnt[us][PAWN])
+          && !cnt[us][ROOK] && !cnt[us][BISHOP] && !cnt[us][KNIGHT]
+          && lone(cnt, ~us, PAWN, cnt[~us][PAWN]);
   }
 
-  bool is_KXKN(const Position& pos, Color us) {
-    return   !pos.count<PAWN>(us)
-          && (pos.count<ROOK>(us) || !pos.count<ROOK>(us))
-          && (pos.count<KNIGHT>(us) || !pos.count<KNIGHT>(us))
-          && (pos.count<BISHOP>(us) || !pos.count<BISHOP>(us))
-          && (pos.count<QUEEN>(us) || !pos.count<QUEEN>(us))
-          && !pos.count<PAWN>(~us)
-          && !pos.count<ROOK>(~us)
-          && pos.count<KNIGHT>(~us) == 1
-          && !pos.count<BISHOP>(~us)
-          && !pos.count<QUEEN>(~us)
-          && pos.non_pawn_material(us) - pos.non_pawn_material(~us) >= BishopValueEg + QueenValueEg;
+  bool is_KXKP(const Counts& cnt, Color us) {
+    return   !cnt[us][PAWN]
+          && lone(cnt, ~us, PAWN, 1)
+          && non_pawn_material(cnt, us) >= BishopValueEg + QueenValueEg;
   }
 
-  bool is_KXKR(const Position& pos, Color us) {
-    return   !pos.count<PAWN>(us)
-          && (pos.count<ROOK>(us) || !pos.count<ROOK>(us))
-          && (pos.count<KNIGHT>(us) || !pos.count<KNIGHT>(us))
-          && (pos.count<BISHOP>(us) || !pos.count<BISHOP>(us))
-          && (pos.count<QUEEN>(us) || !pos.count<QUEEN>(us))
-          && !pos.count<PAWN>(~us)
-          && pos.count<ROOK>(~us) == 1
-          && !pos.count<KNIGHT>(~us)
-          && !pos.count<BISHOP>(~us)
-          && !pos.count<QUEEN>(~us)
-          && pos.non_pawn_material(us) - pos.non_pawn_material(~us) >= BishopValueEg + QueenValueEg;
+  // is_KXKX() detects a lone piece of type pt against pieces without pawns
+  bool is_KXKX(const Counts& cnt, Color us, PieceType pt) {
+    return   !cnt[us][PAWN]
+          && lone(cnt, ~us, pt, 1)
+          && non_pawn_material(cnt, us) - non_pawn_material(cnt, ~us) >= BishopValueEg + QueenValueEg;
   }
 
   /// imbalance() calculates the imbalance by comparing the piece count of each
   /// piece type for both colors.
   template<Color Us>
-  int imbalance(const int pieceCount[][PIECE_TYPE_NB]) {
+  int imbalance(const Counts& pieceCount) {
 
     constexpr Color Them = (Us == WHITE ? BLACK : WHITE);
 
@@ -179,122 +143,246 @@ namespace {
     return bonus;
   }
 
+  // index_of() returns the index of an endgame function in the given list.
+  // Material::init() registers all the functions beforehand, so the lists are
+  // only read here, also when probe() computes an entry during the search.
+  template<typename T>
+  uint8_t index_of(const std::vector<EndgameBase<T>*>& list, EndgameBase<T>* f) {
+
+    if (!f)
+        return 0;
+
+    auto it = std::find(list.begin(), list.end(), f);
+    assert(it != list.end());
+    return uint8_t(it - list.begin());
+  }
+
+  // register_functions() appends all the generic and specialized endgame
+  // functions of one type to the given list.
+  template<typename T>
+  void register_functions(std::vector<EndgameBase<T>*>& list,
+                          std::initializer_list<EndgameBase<T>*> generic) {
+
+    list.assign(1, nullptr);
+    list.insert(list.end(), generic);
+
+    for (const auto& f : Endgames::registry<T>().functions)
+        if (f)
+            list.push_back(f.get());
+
+    assert(list.size() <= 256);
+  }
+
+  // compute() fills an entry for the given piece counts. The material key, needed
+  // to look up the specialized endgame functions, is 0 when none can match.
+  void compute(Material::Entry* e, const Counts& cnt, Key key) {
+
+    using namespace Material;
+
+    std::memset(e, 0, sizeof(Entry));
+    e->factor[WHITE] = e->factor[BLACK] = (uint8_t)SCALE_FACTOR_NORMAL;
+
+    Value npm_w = non_pawn_material(cnt, WHITE);
+    Value npm_b = non_pawn_material(cnt, BLACK);
+    Value npm = std::max(EndgameLimit, std::min(npm_w + npm_b, MidgameLimit));
+
+    // Map total non-pawn material into [PHASE_ENDGAME, PHASE_MIDGAME]
+    e->gamePhase = uint8_t(((npm - EndgameLimit) * PHASE_MIDGAME) / (MidgameLimit - EndgameLimit));
+
+    // Let's look if we have a specialized evaluation function for this particular
+    // material configuration. Firstly we look for a fixed configuration one, then
+    // for a generic one if the previous search failed.
+    if (key && (e->evaluationFunction = index_of(EvaluationFunctions, Endgames::probe<Value>(key))))
+        return;
+
+    EndgameBase<Value>* f = nullptr;
+
+    for (Color c = WHITE; c <= BLACK && !f; ++c)
+        f = is_KXK(cnt, c)                ? &EvaluateKXK[c]
+          : nullptr;
+
+    // Only queens and pawns against bare king
+    for (Color c = WHITE; c <= BLACK && !f; ++c)
+        f = is_KQsPsK(cnt, c)             ? &EvaluateKQsPsK[c]
+          : nullptr;
+
+    for (Color c = WHITE; c <= BLACK && !f; ++c)
+        f = is_KXKP(cnt, c)               ? &EvaluateKXKP[c]
+          : nullptr;
+
+    for (Color c = WHITE; c <= BLACK && !f; ++c)
+        f = is_KXKX(cnt, c, QUEEN)        ? &EvaluateKXKQ[c]
+          : nullptr;
+
+    for (Color c = WHITE; c <= BLACK && !f; ++c)
+        f = is_KXKX(cnt, c, BISHOP)       ? &EvaluateKXKB[c]
+          : nullptr;
+
+    for (Color c = WHITE; c <= BLACK && !f; ++c)
+        f = is_KXKX(cnt, c, KNIGHT)       ? &EvaluateKXKN[c]
+          : nullptr;
+
+    for (Color c = WHITE; c <= BLACK && !f; ++c)
+        f = is_KXKX(cnt, c, ROOK)         ? &EvaluateKXKR[c]
+          : nullptr;
+
+    if ((e->evaluationFunction = index_of(EvaluationFunctions, f)))
+        return;
+
+    // OK, we didn't find any special evaluation function for the current material
+    // configuration. Is there a suitable specialized scaling function?
+    EndgameBase<ScaleFactor>* sf;
+
+    if (key && (sf = Endgames::probe<ScaleFactor>(key)) != nullptr)
+    {
+        // Only strong color assigned
+        e->scalingFunction[sf->strongSide] = index_of(ScalingFunctions, sf);
+        return;
+    }
+
+    // Zero or just one pawn makes it difficult to win, even with a small material
+    // advantage. This catches some trivial draws like KK, KBK and KNK and gives a
+    // drawish scale factor for cases such as KRKBP and KmmKm (except for KBBKN).
+    if (!cnt[WHITE][PAWN] && npm_w - npm_b <= BishopValueMg)
+        e->factor[WHITE] = uint8_t(npm_w <  RookValueMg   ? SCALE_FACTOR_DRAW :
+                                   npm_b <= BishopValueMg ? 4 : 14);
+
+    if (!cnt[BLACK][PAWN] && npm_b - npm_w <= BishopValueMg)
+        e->factor[BLACK] = uint8_t(npm_b <  RookValueMg   ? SCALE_FACTOR_DRAW :
+                                   npm_w <= BishopValueMg ? 4 : 14);
+
+    // Evaluate the material imbalance. We use PIECE_TYPE_NONE as a place holder
+    // for the bishop pair "extended piece", which allows us to be more flexible
+    // in defining bishop pair bonuses.
+    e->value = int16_t((imbalance<WHITE>(cnt) - imbalance<BLACK>(cnt)) / 16);
+  }
+
+  // side_index() returns the index of the material of one side in the table,
+  // or -1 if it is beyond the limits of the table.
+  int side_index(const Position& pos, Color c) {
+
+    int queens = pos.count<QUEEN>(c), pawns = pos.count<PAWN>(c);
+    int bishops = pos.count<BISHOP>(c), knights = pos.count<KNIGHT>(c), rooks = pos.count<ROOK>(c);
+
+    if (   queens > MaxQueens || pawns > MaxPawns
+        || bishops > MaxPieces || knights > MaxPieces || rooks > MaxPieces)
+        return -1;
+
+    int queenState = queens + (queens == MaxQueens && pos.queen_pair(c));
+
+    return (((queenState * (MaxPawns + 1) + pawns) * (MaxPieces + 1) + bishops)
+                         * (MaxPieces + 1) + knights) * (MaxPieces + 1) + rooks;
+  }
+
+  // code() returns the endgame code of a material configuration, like "KRPKN",
+  // as expected by Position::set().
+  std::string code(const Counts& cnt) {
+
+    std::string s;
+    for (Color c = WHITE; c <= BLACK; ++c)
+    {
+        s += 'K';
+        for (PieceType pt = ROOK; pt >= PAWN; --pt)
+            s += std::string(cnt[c][pt], " PMSNRK"[pt]);
+    }
+    return s;
+  }
+
 } // namespace
 
 namespace Material {
 
-/// Material::probe() looks up the current position's material configuration in
-/// the material hash table. It returns a pointer to the Entry if the position
-/// is found. Otherwise a new Entry is computed and stored there, so we don't
-/// have to recompute all when the same material configuration occurs again.
+std::vector<EndgameBase<Value>*> EvaluationFunctions = { nullptr };
+std::vector<EndgameBase<ScaleFactor>*> ScalingFunctions = { nullptr };
 
-Entry* probe(const Position& pos) {
 
-  Key key = pos.material_key();
-  Entry* e = pos.this_thread()->materialTable[key];
+/// Material::init() computes the entries of all the material configurations
+/// covered by the table, which is then shared read-only by all the threads.
+/// The table is indexed by a perfect hash of the piece counts of both sides,
+/// see side_index(), so that probing a configuration it covers needs no key
+/// check. The endgame function lists are filled first, so that entries can
+/// refer to them by index and computing an entry never modifies them.
 
-  if (e->key == key)
-      return e;
+void init() {
 
-  std::memset(e, 0, sizeof(Entry));
-  e->key = key;
-  e->factor[WHITE] = e->factor[BLACK] = (uint8_t)SCALE_FACTOR_NORMAL;
+  register_functions<Value>(EvaluationFunctions, {
+      &EvaluateKXK[WHITE],    &EvaluateKXK[BLACK],    &EvaluateKQsPsK[WHITE], &EvaluateKQsPsK[BLACK],
+      &EvaluateKXKP[WHITE],   &EvaluateKXKP[BLACK],   &EvaluateKXKQ[WHITE],   &EvaluateKXKQ[BLACK],
+      &EvaluateKXKB[WHITE],   &EvaluateKXKB[BLACK],   &EvaluateKXKN[WHITE],   &EvaluateKXKN[BLACK],
+      &EvaluateKXKR[WHITE],   &EvaluateKXKR[BLACK] });
+  register_functions<ScaleFactor>(ScalingFunctions, {});
 
-  Value npm_w = pos.non_pawn_material(WHITE);
-  Value npm_b = pos.non_pawn_material(BLACK);
-  Value npm = std::max(EndgameLimit, std::min(npm_w + npm_b, MidgameLimit));
+  Table.resize(size_t(SideNb) * SideNb);
 
-  // Map total non-pawn material into [PHASE_ENDGAME, PHASE_MIDGAME]
-  e->gamePhase = Phase(((npm - EndgameLimit) * PHASE_MIDGAME) / (MidgameLimit - EndgameLimit));
+  int side[SideNb][PIECE_TYPE_NB] = {};
 
-  // Let's look if we have a specialized evaluation function for this particular
-  // material configuration. Firstly we look for a fixed configuration one, then
-  // for a generic one if the previous search failed.
-  if ((e->evaluationFunction = pos.this_thread()->endgames.probe<Value>(key)) != nullptr)
-      return e;
+  // Decode the piece counts of every side index, as side_index() encodes them
+  for (int i = 0; i < SideNb; ++i)
+  {
+      int n = i;
+      side[i][ROOK  ] = n % (MaxPieces + 1), n /= MaxPieces + 1;
+      side[i][KNIGHT] = n % (MaxPieces + 1), n /= MaxPieces + 1;
+      side[i][BISHOP] = n % (MaxPieces + 1), n /= MaxPieces + 1;
+      side[i][PAWN  ] = n % (MaxPawns  + 1), n /= MaxPawns  + 1;
+      side[i][QUEEN ] = std::min(n, MaxQueens);
+      side[i][NO_PIECE_TYPE] = n > MaxQueens;
+  }
 
-  for (Color c = WHITE; c <= BLACK; ++c)
-      if (is_KXK(pos, c))
+  for (int w = 0; w < SideNb; ++w)
+      for (int b = 0; b < SideNb; ++b)
       {
-          e->evaluationFunction = &EvaluateKXK[c];
-          return e;
+          Counts c;
+          std::memcpy(c[WHITE], side[w], sizeof(c[WHITE]));
+          std::memcpy(c[BLACK], side[b], sizeof(c[BLACK]));
+
+          // Specialized endgame functions exist only for a few pieces
+          int pieces = 0;
+          for (PieceType pt = PAWN; pt <= ROOK; ++pt)
+              pieces += c[WHITE][pt] + c[BLACK][pt];
+
+          Key key = 0;
+          if (pieces <= 5)
+          {
+              StateInfo st;
+              key = Position().set(code(c), WHITE, &st).material_key();
+          }
+
+          compute(&Table[w * SideNb + b], c, key);
       }
+}
 
-  // Only queens and pawns against bare king
-  for (Color c = WHITE; c <= BLACK; ++c)
-      if (is_KQsPsK(pos, c))
-      {
-          e->evaluationFunction = &EvaluateKQsPsK[c];
-          return e;
-      }
 
-  for (Color c = WHITE; c <= BLACK; ++c)
-      if (is_KXKP(pos, c))
-      {
-          e->evaluationFunction = &EvaluateKXKP[c];
-          return e;
-      }
-	  
-  for (Color c = WHITE; c <= BLACK; ++c)
-      if (is_KXKQ(pos, c))
-      {
-          e->evaluationFunction = &EvaluateKXKQ[c];
-          return e;
-      }
+/// Material::probe() looks up the current position's material configuration in
+/// the shared table. Configurations beyond the table, which are rare and can
+/// only arise with more than one promoted queen or from a set up position, are
+/// computed on the fly into a per-thread entry, reused while the material key
+/// and the queen pairs do not change.
 
-  for (Color c = WHITE; c <= BLACK; ++c)
-      if (is_KXKB(pos, c))
-      {
-          e->evaluationFunction = &EvaluateKXKB[c];
-          return e;
-      }
+Entry* probe(const Position& pos) {
 
-  for (Color c = WHITE; c <= BLACK; ++c)
-      if (is_KXKN(pos, c))
-      {
-          e->evaluationFunction = &EvaluateKXKN[c];
-          return e;
-      }
+  int w = side_index(pos, WHITE), b = side_index(pos, BLACK);
 
-  for (Color c = WHITE; c <= BLACK; ++c)
-      if (is_KXKR(pos, c))
-      {
-          e->evaluationFunction = &EvaluateKXKR[c];
-          return e;
-      }
+  if (w >= 0 && b >= 0)
+      return &Table[w * SideNb + b];
+
+  thread_local Entry e;
+  thread_local Key lastKey = 0;
 
-  // OK, we didn't find any special evaluation function for the current material
-  // configuration. Is there a suitable specialized scaling function?
-  EndgameBase<ScaleFactor>* sf;
+  Key key = pos.material_key() ^ pos.queen_pair(WHITE) ^ (Key(pos.queen_pair(BLACK)) << 1);
 
-  if ((sf = pos.this_thread()->endgames.probe<ScaleFactor>(key)) != nullptr)
+  if (key != lastKey)
   {
-      e->scalingFunction[sf->strongSide] = sf; // Only strong color assigned
-      return e;
+      const Counts cnt = {
+      { pos.queen_pair(WHITE), pos.count<PAWN>(WHITE), pos.count<QUEEN >(WHITE),
+        pos.count<BISHOP>(WHITE), pos.count<KNIGHT>(WHITE), pos.count<ROOK>(WHITE) },
+      { pos.queen_pair(BLACK), pos.count<PAWN>(BLACK), pos.count<QUEEN >(BLACK),
+        pos.count<BISHOP>(BLACK), pos.count<KNIGHT>(BLACK), pos.count<ROOK>(BLACK) } };
+
+      compute(&e, cnt, pos.material_key());
+      lastKey = key;
   }
 
-  // Zero or just one pawn makes it difficult to win, even with a small material
-  // advantage. This catches some trivial draws like KK, KBK and KNK and gives a
-  // drawish scale factor for cases such as KRKBP and KmmKm (except for KBBKN).
-  if (!pos.count<PAWN>(WHITE) && npm_w - npm_b <= BishopValueMg)
-      e->factor[WHITE] = uint8_t(npm_w <  RookValueMg   ? SCALE_FACTOR_DRAW :
-                                 npm_b <= BishopValueMg ? 4 : 14);
-
-  if (!pos.count<PAWN>(BLACK) && npm_b - npm_w <= BishopValueMg)
-      e->factor[BLACK] = uint8_t(npm_b <  RookValueMg   ? SCALE_FACTOR_DRAW :
-                                 npm_w <= BishopValueMg ? 4 : 14);
-
-  // Evaluate the material imbalance. We use PIECE_TYPE_NONE as a place holder
-  // for the bishop pair "extended piece", which allows us to be more flexible
-  // in defining bishop pair bonuses.
-  const int pieceCount[COLOR_NB][PIECE_TYPE_NB] = {
-  { pos.queen_pair(WHITE), pos.count<PAWN>(WHITE), pos.count<QUEEN >(WHITE),
-    pos.count<BISHOP>(WHITE), pos.count<KNIGHT>(WHITE), pos.count<ROOK>(WHITE) },
-  { pos.queen_pair(BLACK), pos.count<PAWN>(BLACK), pos.count<QUEEN >(BLACK),
-    pos.count<BISHOP>(BLACK), pos.count<KNIGHT>(BLACK), pos.count<ROOK>(BLACK) } };
-
-  e->value = int16_t((imbalance<WHITE>(pieceCount) - imbalance<BLACK>(pieceCount)) / 16);
-  return e;
+  return &e;
 }
 
 } // namespace Material
@@ -21,28 +21,36 @@
 #ifndef MATERIAL_H_INCLUDED
 #define MATERIAL_H_INCLUDED
 
+#include <vector>
+
 #include "endgame.h"
-#include "misc.h"
 #include "position.h"
 #include "types.h"
 
 namespace Material {
 
 /// Material::Entry contains various information about a material configuration.
-/// It contains a material imbalance evaluation, a function pointer to a special
-/// endgame evaluation function (which in most cases is NULL, meaning that the
-/// standard evaluation function will be used), and scale factors.
+/// It contains a material imbalance evaluation, the index of a special endgame
+/// evaluation function (which in most cases is 0, meaning that the standard
+/// evaluation function will be used), and scale factors.
 ///
 /// The scale factors are used to scale the evaluation score up or down. For
 /// instance, in KRB vs KR endgames, the score is scaled down by a factor of 4,
 /// which will result in scores of absolute value less than one pawn.
+///
+/// Entries are kept small because there is one for every material configuration,
+/// so endgame functions are referred to by their index in EvaluationFunctions
+/// and ScalingFunctions, where index 0 is a null pointer.
+
+extern std::vector<EndgameBase<Value>*> EvaluationFunctions;
+extern std::vector<EndgameBase<ScaleFactor>*> ScalingFunctions;
 
 struct Entry {
 
   Score imbalance() const { return make_score(value, value); }
-  Phase game_phase() const { return gamePhase; }
-  bool specialized_eval_exists() const { return evaluationFunction != nullptr; }
-  Value evaluate(const Position& pos) const { return (*evaluationFunction)(pos); }
+  Phase game_phase() const { return Phase(gamePhase); }
+  bool specialized_eval_exists() const { return evaluationFunction != 0; }
+  Value evaluate(const Position& pos) const { return (*EvaluationFunctions[evaluationFunction])(pos); }
 
   // scale_factor takes a position and a color as input and returns a scale factor
   // for the given color. We have to provide the position in addition to the color
@@ -50,22 +58,20 @@ struct Entry {
   // the position. For instance, in KBP vs K endgames, the scaling function looks
   // for rook pawns and wrong-colored bishops.
   ScaleFactor scale_factor(const Position& pos, Color c) const {
-    ScaleFactor sf = scalingFunction[c] ? (*scalingFunction[c])(pos)
+    ScaleFactor sf = scalingFunction[c] ? (*ScalingFunctions[scalingFunction[c]])(pos)
                                         :  SCALE_FACTOR_NONE;
     return sf != SCALE_FACTOR_NONE ? sf : ScaleFactor(factor[c]);
   }
 
-  Key key;
-  EndgameBase<Value>* evaluationFunction;
-  EndgameBase<ScaleFactor>* scalingFunction[COLOR_NB]; // Could be one for each
-                                                       // side (e.g. KPKP, KBPsKs)
   int16_t value;
   uint8_t factor[COLOR_NB];
-  Phase gamePhase;
+  uint8_t gamePhase;
+  uint8_t evaluationFunction;
+  uint8_t scalingFunction[COLOR_NB]; // Could be one for each
+                                     // side (e.g. KPKP, KBPsKs)
 };
 
-typedef HashTable<Entry, 8192> Table;
-
+void init();
 Entry* probe(const Position& pos);
 
 } // namespace Material
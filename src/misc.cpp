@@ -28,6 +28,7 @@
 #define NOMINMAX
 #endif
 
+#include <malloc.h>  // For _aligned_malloc()
 #include <windows.h>
 // The needed Windows API for processor groups could be missed from old Windows
 // versions, so instead of calling them directly (forcing the linker to resolve
@@ -41,6 +42,15 @@ typedef bool(*fun3_t)(HANDLE, CONST GROUP_AFFINITY*, PGROUP_AFFINITY);
 }
 #endif
 
+#if defined(__linux__)
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
 #include <fstream>
 #include <iomanip>
 #include <iostream>
@@ -144,24 +154,140 @@ const string engine_info(bool to_uci) {
 }
 
 
-/// Debug functions used mainly to collect run-time statistics
-static int64_t hits[2], means[2];
+/// Debug functions used mainly to collect run-time statistics. Every thread
+/// owns a cache line aligned block of counters that only that thread writes,
+/// with relaxed loads and stores, so that counting is race free and does not
+/// bounce cache lines between cores. The blocks are registered in a list to
+/// be summed on demand, and fold their counts into 'retired' on thread exit.
+#ifdef USE_STATS
+
+namespace {
+
+constexpr int HistBuckets = 16;
+
+const char* DbgNames[DBG_COUNTER_NB] = {
+  "generic", "null move cutoff", "singular extension", "lmr re-search", "lmr reduction"
+};
+
+template<typename T>
+struct DbgData {
+  T* cells() { return &hits[0][0]; }
+
+  T hits[DBG_COUNTER_NB][2];
+  T means[DBG_COUNTER_NB][2];
+  T hist[DBG_COUNTER_NB][HistBuckets];
+};
+
+typedef DbgData<int64_t> DbgTotals;
+constexpr size_t DbgCells = sizeof(DbgTotals) / sizeof(int64_t);
+
+struct alignas(64) DbgBlock : public DbgData<std::atomic<int64_t>> {
+  DbgBlock();
+ ~DbgBlock();
+};
+
+Mutex dbgMutex;
+std::vector<DbgBlock*> dbgBlocks;
+DbgTotals dbgRetired;
+thread_local DbgBlock dbgLocal;
+
+DbgBlock::DbgBlock() {
+
+  for (size_t i = 0; i < DbgCells; ++i)
+      cells()[i] = 0;
+
+  std::lock_guard<Mutex> lk(dbgMutex);
+  dbgBlocks.push_back(this);
+}
+
+DbgBlock::~DbgBlock() {
+
+  std::lock_guard<Mutex> lk(dbgMutex);
+
+  for (size_t i = 0; i < DbgCells; ++i)
+      dbgRetired.cells()[i] += cells()[i];
+
+  dbgBlocks.erase(std::find(dbgBlocks.begin(), dbgBlocks.end(), this));
+}
+
+inline void add(std::atomic<int64_t>& a, int64_t v) {
+  a.store(a.load(std::memory_order_relaxed) + v, std::memory_order_relaxed);
+}
+
+DbgTotals dbg_collect(bool reset) {
+
+  std::lock_guard<Mutex> lk(dbgMutex);
+
+  DbgTotals t = dbgRetired;
+
+  for (DbgBlock* b : dbgBlocks)
+      for (size_t i = 0; i < DbgCells; ++i)
+      {
+          t.cells()[i] += b->cells()[i].load(std::memory_order_relaxed);
+
+          if (reset)
+              b->cells()[i].store(0, std::memory_order_relaxed);
+      }
 
-void dbg_hit_on(bool b) { ++hits[0]; if (b) ++hits[1]; }
-void dbg_hit_on(bool c, bool b) { if (c) dbg_hit_on(b); }
-void dbg_mean_of(int v) { ++means[0]; means[1] += v; }
+  if (reset)
+      dbgRetired = DbgTotals();
+
+  return t;
+}
+
+std::string dbg_format(DbgTotals& t) {
+
+  std::stringstream ss;
+
+  for (int c = 0; c < DBG_COUNTER_NB; ++c)
+  {
+      if (t.hits[c][0])
+          ss << DbgNames[c] << ": total " << t.hits[c][0] << " hits " << t.hits[c][1]
+             << " hit rate (%) " << 100 * t.hits[c][1] / t.hits[c][0] << "\n";
+
+      if (t.means[c][0])
+          ss << DbgNames[c] << ": total " << t.means[c][0] << " mean "
+             << (double)t.means[c][1] / t.means[c][0] << "\n";
+
+      if (std::any_of(t.hist[c], t.hist[c] + HistBuckets, [](int64_t n) { return n; }))
+      {
+          ss << DbgNames[c] << ": histogram";
+          for (int i = 0; i < HistBuckets; ++i)
+              ss << " " << i << (i == HistBuckets - 1 ? "+:" : ":") << t.hist[c][i];
+          ss << "\n";
+      }
+  }
+
+  return ss.str();
+}
+
+} // namespace
+
+void dbg_hit_on(DbgCounter c, bool b) { add(dbgLocal.hits[c][0], 1); if (b) add(dbgLocal.hits[c][1], 1); }
+void dbg_mean_of(DbgCounter c, int v) { add(dbgLocal.means[c][0], 1); add(dbgLocal.means[c][1], v); }
+void dbg_hist_of(DbgCounter c, int v) { add(dbgLocal.hist[c][std::min(std::max(v, 0), HistBuckets - 1)], 1); }
 
 void dbg_print() {
 
-  if (hits[0])
-      cerr << "Total " << hits[0] << " Hits " << hits[1]
-           << " hit rate (%) " << 100 * hits[1] / hits[0] << endl;
+  DbgTotals t = dbg_collect(false);
+  cerr << dbg_format(t) << flush;
+}
 
-  if (means[0])
-      cerr << "Total " << means[0] << " Mean "
-           << (double)means[1] / means[0] << endl;
+/// dbg_stats() returns the counters summed over all threads and resets them
+std::string dbg_stats() {
+
+  DbgTotals t = dbg_collect(true);
+  std::string s = dbg_format(t);
+
+  return s.empty() ? "No debug counters recorded" : s.substr(0, s.size() - 1);
 }
 
+#else
+
+std::string dbg_stats() { return "Debug counters are not compiled in, build with stats=yes"; }
+
+#endif
+
 
 /// Used to serialize access to std::cout to avoid multiple threads writing at
 /// the same time.
@@ -184,6 +310,48 @@ std::ostream& operator<<(std::ostream& os, SyncCout sc) {
 void start_logger(const std::string& fname) { Logger::start(fname); }
 
 
+/// Telemetry is an opt-in stream of JSON lines, one object per line, written
+/// by the search threads to the file set with the "Telemetry File" option.
+/// Lines are flushed as they are written so that the stream can be tailed,
+/// and a path like /dev/fd/3 can be used to send it to an inherited fd.
+
+namespace {
+Mutex telemetryMutex;
+ofstream telemetryFile;
+std::atomic<bool> telemetryOn;
+}
+
+void start_telemetry(const std::string& fname) {
+
+  std::lock_guard<Mutex> lk(telemetryMutex);
+
+  telemetryOn = false;
+
+  if (telemetryFile.is_open())
+      telemetryFile.close();
+
+  if (fname.empty() || fname == "<empty>")
+      return;
+
+  telemetryFile.open(fname, ofstream::out | ofstream::app);
+
+  if (!telemetryFile)
+      sync_cout << "info string Could not open telemetry file " << fname << sync_endl;
+  else
+      telemetryOn = true;
+}
+
+bool telemetry_enabled() { return telemetryOn; }
+
+void telemetry(const std::string& line) {
+
+  std::lock_guard<Mutex> lk(telemetryMutex);
+
+  if (telemetryFile.is_open())
+      telemetryFile << line << std::endl;
+}
+
+
 /// prefetch() preloads the given address in L1/L2 cache. This is a non-blocking
 /// function that doesn't stall the CPU waiting for data to be loaded from memory,
 /// which can be quite slow.
@@ -216,6 +384,147 @@ void prefetch2(void* addr) {
   prefetch((uint8_t*)addr + 64);
 }
 
+
+/// large_pages_alloc() allocates size bytes aligned at least to a cache line,
+/// trying to back them with huge pages to reduce TLB misses on big tables. On
+/// Linux we first ask for explicit 1GB and 2MB pages (MAP_HUGETLB, requires a
+/// preallocated hugetlbfs pool), using a page size only when size is an exact
+/// multiple of it. If that fails we fall back to a 2MB aligned anonymous
+/// mapping advised with MADV_HUGEPAGE, so that the kernel can promote it to
+/// transparent huge pages. pageSize is set to the explicit huge page size that
+/// was obtained, or to 0 for default pages. Returns nullptr on failure.
+
+#if defined(__linux__)
+
+void* large_pages_alloc(size_t size, size_t& pageSize) {
+
+  constexpr size_t HugePage2MB = size_t(1) << 21;
+  void* mem;
+
+  pageSize = 0;
+
+#if defined(MAP_HUGETLB) && defined(MAP_HUGE_SHIFT)
+  constexpr size_t HugePage1GB = size_t(1) << 30;
+
+  for (size_t ps : { HugePage1GB, HugePage2MB })
+  {
+      if (size % ps)
+          continue;
+
+      int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB
+                | ((ps == HugePage1GB ? 30 : 21) << MAP_HUGE_SHIFT);
+
+      mem = mmap(nullptr, size, PROT_READ | PROT_WRITE, flags, -1, 0);
+
+      if (mem != MAP_FAILED)
+          return pageSize = ps, mem;
+  }
+#endif
+
+  // Over-allocate by one huge page and unmap the misaligned head and tail
+  char* raw = (char*)mmap(nullptr, size + HugePage2MB, PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (raw == MAP_FAILED)
+      return nullptr;
+
+  char* aligned = (char*)((uintptr_t(raw) + HugePage2MB - 1) & ~(HugePage2MB - 1));
+
+  if (aligned > raw)
+      munmap(raw, aligned - raw);
+
+  if (raw + HugePage2MB > aligned)
+      munmap(aligned + size, raw + HugePage2MB - aligned);
+
+#if defined(MADV_HUGEPAGE)
+  madvise(aligned, size, MADV_HUGEPAGE);
+#endif
+
+  return aligned;
+}
+
+
+/// large_pages_free() releases memory obtained by large_pages_alloc(), size
+/// must be the one passed at allocation time.
+
+void large_pages_free(void* mem, size_t size) {
+
+  if (mem)
+      munmap(mem, size);
+}
+
+#else
+
+void* large_pages_alloc(size_t size, size_t& pageSize) {
+
+  constexpr size_t CacheLineSize = 64;
+  void* mem;
+
+  pageSize = 0;
+
+#if defined(_WIN32)
+  mem = _aligned_malloc(size, CacheLineSize);
+#else
+  if (posix_memalign(&mem, CacheLineSize, size))
+      mem = nullptr;
+#endif
+
+  return mem;
+}
+
+void large_pages_free(void* mem, size_t) {
+
+#if defined(_WIN32)
+  _aligned_free(mem);
+#else
+  free(mem);
+#endif
+}
+
+#endif
+
+
+/// aligned_malloc() allocates size bytes aligned to a cache line from the heap,
+/// for the small per-thread buffers that large_pages_alloc() would place on
+/// huge page boundaries, in the same cache sets as the other tables. Returns
+/// nullptr on failure. Memory is released with aligned_free().
+
+void* aligned_malloc(size_t size) {
+
+  constexpr size_t CacheLineSize = 64;
+
+#if defined(_WIN32)
+  return _aligned_malloc(size, CacheLineSize);
+#else
+  void* mem;
+  return posix_memalign(&mem, CacheLineSize, size) ? nullptr : mem;
+#endif
+}
+
+void aligned_free(void* mem) {
+
+#if defined(_WIN32)
+  _aligned_free(mem);
+#else
+  free(mem);
+#endif
+}
+
+
+/// major_faults() returns the number of page faults of the calling thread that
+/// needed a read from disk, as when probing a tablebase file that is not in the
+/// page cache yet. It is always 0 outside Linux.
+
+uint64_t major_faults() {
+
+#if defined(__linux__) && defined(RUSAGE_THREAD)
+  struct rusage ru;
+  if (!getrusage(RUSAGE_THREAD, &ru))
+      return uint64_t(ru.ru_majflt);
+#endif
+
+  return 0;
+}
+
 namespace WinProcGroup {
 
 #ifndef _WIN32
@@ -320,3 +629,142 @@ void bindThisThread(size_t idx) {
 #endif
 
 } // namespace WinProcGroup
+
+
+namespace CpuBinding {
+
+#if !defined(__linux__)
+
+void bindThisThread(size_t, const std::string&) {}
+
+#else
+
+namespace {
+
+/// read_cpu_list() parses a sysfs list of processors or nodes, like "0-3,8,10-11"
+
+std::vector<int> read_cpu_list(const std::string& fname) {
+
+  std::vector<int> list;
+  std::ifstream file(fname);
+  std::string range;
+
+  while (std::getline(file, range, ','))
+  {
+      std::istringstream ss(range);
+      int first, last;
+      char dash;
+
+      if (!(ss >> first))
+          continue;
+
+      if (!(ss >> dash >> last))
+          last = first;
+
+      for (int i = first; i <= last; ++i)
+          list.push_back(i);
+  }
+
+  return list;
+}
+
+int read_int(const std::string& fname) {
+
+  std::ifstream file(fname);
+  int v = -1;
+  file >> v;
+  return v;
+}
+
+
+/// binding_order() returns the logical processors available to the process in
+/// the order they should be assigned to threads. Within each node the first
+/// logical processor of every physical core comes before the SMT siblings.
+
+std::vector<int> binding_order(bool spread) {
+
+  const std::string sysCpu = "/sys/devices/system/cpu/", sysNode = "/sys/devices/system/node/";
+  std::vector<std::vector<int>> nodes;
+  std::vector<int> order;
+  cpu_set_t allowed;
+
+  if (sched_getaffinity(0, sizeof(allowed), &allowed))
+      return order;
+
+  for (int n : read_cpu_list(sysNode + "online"))
+      nodes.push_back(read_cpu_list(sysNode + "node" + std::to_string(n) + "/cpulist"));
+
+  if (nodes.empty()) // Kernel without NUMA support
+      nodes.push_back(read_cpu_list(sysCpu + "online"));
+
+  for (auto& cpus : nodes)
+  {
+      std::vector<int> cores, siblings;
+      std::vector<std::pair<int, int>> seen; // (package, core id) pairs
+
+      for (int c : cpus)
+      {
+          if (c >= CPU_SETSIZE || !CPU_ISSET(c, &allowed))
+              continue;
+
+          std::string topo = sysCpu + "cpu" + std::to_string(c) + "/topology/";
+          std::pair<int, int> core(read_int(topo + "physical_package_id"),
+                                   read_int(topo + "core_id"));
+
+          if (std::find(seen.begin(), seen.end(), core) != seen.end())
+              siblings.push_back(c);
+          else
+          {
+              seen.push_back(core);
+              cores.push_back(c);
+          }
+      }
+
+      cpus = cores;
+      cpus.insert(cpus.end(), siblings.begin(), siblings.end());
+  }
+
+  if (!spread)
+      for (auto& cpus : nodes)
+          order.insert(order.end(), cpus.begin(), cpus.end());
+  else
+      for (size_t i = 0, added = 1; added; ++i)
+      {
+          added = 0;
+          for (auto& cpus : nodes)
+              if (i < cpus.size())
+                  order.push_back(cpus[i]), added++;
+      }
+
+  return order;
+}
+
+} // namespace
+
+
+/// bindThisThread() sets the affinity of the current thread to a single
+/// logical processor, chosen according to the thread index and the policy.
+
+void bindThisThread(size_t idx, const std::string& policy) {
+
+  if (policy == "off")
+      return;
+
+  // Topology is read only once, thread-safe initialization of local statics
+  static const std::vector<int> Compact = binding_order(false);
+  static const std::vector<int> Spread  = binding_order(true);
+
+  const std::vector<int>& order = policy == "spread" ? Spread : Compact;
+
+  if (idx >= order.size())
+      return;
+
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(order[idx], &set);
+  sched_setaffinity(0, sizeof(set), &set);
+}
+
+#endif
+
+} // namespace CpuBinding
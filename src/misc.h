@@ -21,9 +21,11 @@
 #ifndef MISC_H_INCLUDED
 #define MISC_H_INCLUDED
 
+#include <algorithm>
 #include <cassert>
 #include <chrono>
-#include <ostream>
+#include <cstdlib>
+#include <iostream>
 #include <string>
 #include <vector>
 
@@ -33,11 +35,40 @@ const std::string engine_info(bool to_uci = false);
 void prefetch(void* addr);
 void prefetch2(void* addr);
 void start_logger(const std::string& fname);
+void start_telemetry(const std::string& fname);
+bool telemetry_enabled();
+void telemetry(const std::string& line);
+void* large_pages_alloc(size_t size, size_t& pageSize);
+void large_pages_free(void* mem, size_t size);
+void* aligned_malloc(size_t size);
+void aligned_free(void* mem);
+uint64_t major_faults();
+
+/// Debug counters are named statistics kept per thread and summed on demand.
+/// They are compiled in only when building with stats=yes (-DUSE_STATS),
+/// otherwise all the calls below are empty and vanish from the search.
+
+enum DbgCounter {
+  DBG_GENERIC, DBG_NULL_MOVE, DBG_SINGULAR, DBG_LMR_RESEARCH, DBG_LMR_REDUCTION,
+  DBG_COUNTER_NB
+};
 
-void dbg_hit_on(bool b);
-void dbg_hit_on(bool c, bool b);
-void dbg_mean_of(int v);
+#ifdef USE_STATS
+void dbg_hit_on(DbgCounter c, bool b);
+void dbg_mean_of(DbgCounter c, int v);
+void dbg_hist_of(DbgCounter c, int v);
 void dbg_print();
+#else
+inline void dbg_hit_on(DbgCounter, bool) {}
+inline void dbg_mean_of(DbgCounter, int) {}
+inline void dbg_hist_of(DbgCounter, int) {}
+inline void dbg_print() {}
+#endif
+
+inline void dbg_hit_on(bool b) { dbg_hit_on(DBG_GENERIC, b); }
+inline void dbg_hit_on(bool c, bool b) { if (c) dbg_hit_on(b); }
+inline void dbg_mean_of(int v) { dbg_mean_of(DBG_GENERIC, v); }
+std::string dbg_stats();
 
 typedef std::chrono::milliseconds::rep TimePoint; // A value in milliseconds
 
@@ -48,12 +79,67 @@ inline TimePoint now() {
         (std::chrono::steady_clock::now().time_since_epoch()).count();
 }
 
+/// HashStats counts the probes of a HashTable and how many of them found the
+/// entry. Counters are updated by the owning thread only.
+
+struct HashStats {
+  uint64_t probes = 0, hits = 0;
+
+  double hit_rate() const { return probes ? double(hits) / probes : 0.0; }
+  HashStats& operator+=(const HashStats& s) { probes += s.probes; hits += s.hits; return *this; }
+  HashStats operator-(const HashStats& s) const { HashStats d; d.probes = probes - s.probes; d.hits = hits - s.hits; return d; }
+};
+
+/// HashTable is a table of entries indexed by the lowest bits of a key. Its
+/// size is Size entries unless another one is given to init(), rounded down
+/// to a power of 2, and 0 leaves the table empty. Storage is allocated by
+/// init(), which is called by the owning thread so that on NUMA systems the
+/// table is first-touched in local memory. It comes from large_pages_alloc(),
+/// so it is aligned to a cache line at least.
+
 template<class Entry, int Size>
 struct HashTable {
-  Entry* operator[](Key key) { return &table[(uint32_t)key & (Size - 1)]; }
+
+  HashTable() = default;
+  HashTable(const HashTable&) = delete;
+  HashTable& operator=(const HashTable&) = delete;
+  ~HashTable() { large_pages_free(table, entries * sizeof(Entry)); }
+
+  Entry* operator[](Key key) { return &table[(uint32_t)key & (entries - 1)]; }
+  size_t size() const { return entries; }
+  void clear() { std::fill(table, table + entries, Entry()); }
+
+  void init(size_t size = Size) {
+
+    while (size & (size - 1))
+        size &= size - 1;
+
+    large_pages_free(table, entries * sizeof(Entry));
+    table = nullptr;
+    entries = 0;
+
+    if (!size)
+        return;
+
+    size_t pageSize;
+    table = (Entry*)large_pages_alloc(size * sizeof(Entry), pageSize);
+
+    if (!table)
+    {
+        std::cerr << "Failed to allocate " << size * sizeof(Entry)
+                  << " bytes for a hash table." << std::endl;
+        exit(EXIT_FAILURE);
+    }
+
+    entries = size;
+    clear();
+  }
+
+  HashStats stats;
 
 private:
-  std::vector<Entry> table = std::vector<Entry>(Size);
+  Entry* table = nullptr;
+  size_t entries = 0;
 };
 
 
@@ -111,4 +197,16 @@ namespace WinProcGroup {
   void bindThisThread(size_t idx);
 }
 
+
+/// On Linux search threads can be bound to logical processors, according to
+/// the topology read from sysfs. The "compact" policy fills all the physical
+/// cores of a NUMA node before moving to the next one, the "spread" policy
+/// assigns threads to nodes round-robin. In both cases SMT siblings are used
+/// only after all the physical cores, and threads beyond the number of
+/// available logical processors are left to the OS.
+
+namespace CpuBinding {
+  void bindThisThread(size_t idx, const std::string& policy);
+}
+
 #endif // #ifndef MISC_H_INCLUDED
@@ -21,6 +21,7 @@
 #include <cassert>
 
 #include "movepick.h"
+#include "tt.h"
 
 namespace {
 
@@ -69,6 +70,9 @@ MovePicker::MovePicker(const Position& p, Move ttm, Depth d, const ButterflyHist
   stage = pos.checkers() ? EVASION_TT : MAIN_TT;
   ttMove = ttm && pos.pseudo_legal(ttm) ? ttm : MOVE_NONE;
   stage += (ttMove == MOVE_NONE);
+
+  if (ttm && !ttMove)
+      TranspositionTable::record_collision();
 }
 
 /// MovePicker constructor for quiescence search
@@ -79,10 +83,13 @@ MovePicker::MovePicker(const Position& p, Move ttm, Depth d, const ButterflyHist
   assert(d <= DEPTH_ZERO);
 
   stage = pos.checkers() ? EVASION_TT : QSEARCH_TT;
-  ttMove =    ttm
-           && pos.pseudo_legal(ttm)
+  bool legal = ttm && pos.pseudo_legal(ttm);
+  ttMove =    legal
            && (depth > DEPTH_QS_RECAPTURES || to_sq(ttm) == recaptureSquare) ? ttm : MOVE_NONE;
   stage += (ttMove == MOVE_NONE);
+
+  if (ttm && !legal)
+      TranspositionTable::record_collision();
 }
 
 /// MovePicker constructor for ProbCut: we generate captures with SEE greater
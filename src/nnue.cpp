@@ -0,0 +1,389 @@
+/*
+  Stockfish, a UCI chess playing engine derived from Glaurung 2.1
+  Copyright (C) 2004-2008 Tord Romstad (Glaurung author)
+  Copyright (C) 2008-2015 Marco Costalba, Joona Kiiski, Tord Romstad
+  Copyright (C) 2015-2020 Marco Costalba, Joona Kiiski, Gary Linscott, Tord Romstad
+
+  Stockfish is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Stockfish is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+#include <cstring>   // For std::memcpy
+#include <fstream>
+#include <iterator>
+#include <type_traits>
+#include <vector>
+
+#if defined(USE_AVX2)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "bitboard.h"
+#include "nnue.h"
+#include "position.h"
+
+namespace Eval {
+namespace NNUE {
+
+namespace {
+
+  // A network file starts with Version and ArchHash, followed by the size and
+  // text of a free description. Then come the parameters, layer by layer, in
+  // little endian: biases before weights, and weights row by row, one row per
+  // output neuron (one row per input feature for the first layer).
+  constexpr uint32_t Version  = 0x4D4B4E01;
+  constexpr uint32_t ArchHash =  uint32_t(FeatureCount) ^ (uint32_t(HalfDims) << 12)
+                              ^ (uint32_t(Hidden1Dims) << 22) ^ (uint32_t(Hidden2Dims) << 27);
+
+  // Accumulator values and hidden layer outputs are clamped to [0, 127]. The
+  // weights of the hidden layers and of the output are scaled by 64, and the
+  // output is 16 times the evaluation in internal units.
+  constexpr int WeightScaleBits = 6;
+  constexpr int OutputScale = 16;
+
+  // Activations and weights of the hidden layers are 8 bit values, but SSE2
+  // has no multiply-add of bytes, so with SSE2 only they are widened to 16
+  // bits, at load time for the weights.
+#if defined(USE_AVX2) || !defined(__SSE2__)
+  typedef uint8_t Activation;
+  typedef int8_t  HiddenWeight;
+#else
+  typedef int16_t Activation;
+  typedef int16_t HiddenWeight;
+#endif
+
+  alignas(64) int16_t      FtBiases[HalfDims];
+  alignas(64) int16_t      FtWeights[FeatureCount * HalfDims];
+  alignas(64) int32_t      L1Biases[Hidden1Dims];
+  alignas(64) HiddenWeight L1Weights[Hidden1Dims][2 * HalfDims];
+  alignas(64) int32_t      L2Biases[Hidden2Dims];
+  alignas(64) HiddenWeight L2Weights[Hidden2Dims][Hidden1Dims];
+  alignas(64) HiddenWeight OutWeights[Hidden2Dims];
+  int32_t OutBias;
+
+  static_assert(HalfDims % 32 == 0 && Hidden1Dims % 32 == 0 && Hidden2Dims % 32 == 0,
+                "SIMD loops need multiples of 32");
+
+
+  // read_le() decodes 'count' little endian integers of type FileT from the
+  // buffer at 'pos', storing them as type T.
+  template<typename FileT, typename T>
+  bool read_le(const std::vector<char>& buf, size_t& pos, T* out, size_t count) {
+
+    typedef typename std::make_unsigned<FileT>::type U;
+
+    if (buf.size() < pos + count * sizeof(FileT))
+        return false;
+
+    for (size_t i = 0; i < count; ++i, pos += sizeof(FileT))
+    {
+        U v = 0;
+        for (size_t b = 0; b < sizeof(FileT); ++b)
+            v = U(v | U(uint8_t(buf[pos + b])) << (8 * b));
+
+        out[i] = T(FileT(v));
+    }
+
+    return true;
+  }
+
+
+  // feature() returns the index of the feature of piece 'pc' on square 's' for
+  // the side 'perspective', whose king is on 'ksq'. Black sees the board
+  // rotated by 180 degrees and its own pieces as white ones.
+  inline Square orient(Color perspective, Square s) {
+    return perspective == WHITE ? s : Square(s ^ 63);
+  }
+
+  inline int feature(Color perspective, Square ksq, Piece pc, Square s) {
+
+    int p = 2 * (type_of(pc) - PAWN) + (color_of(pc) != perspective);
+
+    return (int(orient(perspective, ksq)) * PieceFeatures + p) * SQUARE_NB + orient(perspective, s);
+  }
+
+
+  // update_row() adds or subtracts a row of first layer weights to a half of
+  // the accumulator, which is not necessarily aligned.
+  template<bool Add>
+  void update_row(int16_t* acc, const int16_t* w) {
+
+#if defined(USE_AVX2)
+    for (int j = 0; j < HalfDims; j += 16)
+    {
+        __m256i a = _mm256_loadu_si256((const __m256i*)(acc + j));
+        __m256i b = _mm256_load_si256((const __m256i*)(w + j));
+        _mm256_storeu_si256((__m256i*)(acc + j), Add ? _mm256_add_epi16(a, b) : _mm256_sub_epi16(a, b));
+    }
+#elif defined(__SSE2__)
+    for (int j = 0; j < HalfDims; j += 8)
+    {
+        __m128i a = _mm_loadu_si128((const __m128i*)(acc + j));
+        __m128i b = _mm_load_si128((const __m128i*)(w + j));
+        _mm_storeu_si128((__m128i*)(acc + j), Add ? _mm_add_epi16(a, b) : _mm_sub_epi16(a, b));
+    }
+#else
+    for (int j = 0; j < HalfDims; ++j)
+        acc[j] = int16_t(Add ? acc[j] + w[j] : acc[j] - w[j]);
+#endif
+  }
+
+
+  // dot() returns the dot product of 'n' activations, in [0, 127], with 'n'
+  // signed 8 bit weights. Both arrays must be aligned to 32 bytes.
+  int32_t dot(const Activation* in, const HiddenWeight* w, int n) {
+
+#if defined(USE_AVX2)
+    const __m256i ones = _mm256_set1_epi16(1);
+    __m256i sum = _mm256_setzero_si256();
+
+    for (int j = 0; j < n; j += 32)
+    {
+        __m256i p = _mm256_maddubs_epi16(_mm256_load_si256((const __m256i*)(in + j)),
+                                         _mm256_load_si256((const __m256i*)(w + j)));
+        sum = _mm256_add_epi32(sum, _mm256_madd_epi16(p, ones));
+    }
+
+    __m128i s = _mm_add_epi32(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1));
+    s = _mm_add_epi32(s, _mm_shuffle_epi32(s, 0x4E));
+    s = _mm_add_epi32(s, _mm_shuffle_epi32(s, 0xB1));
+    return _mm_cvtsi128_si32(s);
+#elif defined(__SSE2__)
+    __m128i sum = _mm_setzero_si128();
+
+    for (int j = 0; j < n; j += 8)
+        sum = _mm_add_epi32(sum, _mm_madd_epi16(_mm_load_si128((const __m128i*)(in + j)),
+                                                _mm_load_si128((const __m128i*)(w + j))));
+
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0x4E));
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0xB1));
+    return _mm_cvtsi128_si32(sum);
+#else
+    int32_t sum = 0;
+
+    for (int j = 0; j < n; ++j)
+        sum += in[j] * w[j];
+
+    return sum;
+#endif
+  }
+
+
+  // transform() writes the accumulator clamped to [0, 127], side to move first
+  void transform(const Accumulator& acc, Color stm, Activation* out) {
+
+    const Color perspectives[] = { stm, ~stm };
+
+    for (int p = 0; p < 2; ++p)
+    {
+        const int16_t* in = acc.values[perspectives[p]];
+        Activation* o = out + p * HalfDims;
+
+#if defined(USE_AVX2)
+        const __m256i zero = _mm256_setzero_si256();
+
+        for (int j = 0; j < HalfDims; j += 32)
+        {
+            __m256i a = _mm256_max_epi16(_mm256_loadu_si256((const __m256i*)(in + j)), zero);
+            __m256i b = _mm256_max_epi16(_mm256_loadu_si256((const __m256i*)(in + j + 16)), zero);
+
+            // Packing works within 128 bit lanes, restore the order afterwards
+            _mm256_store_si256((__m256i*)(o + j), _mm256_permute4x64_epi64(_mm256_packs_epi16(a, b), 0xD8));
+        }
+#elif defined(__SSE2__)
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i max = _mm_set1_epi16(127);
+
+        for (int j = 0; j < HalfDims; j += 8)
+            _mm_store_si128((__m128i*)(o + j),
+                            _mm_min_epi16(_mm_max_epi16(_mm_loadu_si128((const __m128i*)(in + j)), zero), max));
+#else
+        for (int j = 0; j < HalfDims; ++j)
+            o[j] = Activation(std::max(0, std::min(127, int(in[j]))));
+#endif
+    }
+  }
+
+
+  // hidden() computes a hidden layer, with its outputs clamped to [0, 127]
+  template<int InDims, int OutDims>
+  void hidden(const Activation* in, const int32_t* biases, const HiddenWeight (*weights)[InDims], Activation* out) {
+
+    for (int i = 0; i < OutDims; ++i)
+        out[i] = Activation(std::max(0, std::min(127, (biases[i] + dot(in, weights[i], InDims)) >> WeightScaleBits)));
+  }
+
+
+  // refresh() computes the accumulator of a side from scratch
+  void refresh(const Position& pos, Accumulator& acc, Color perspective) {
+
+    Square ksq = pos.square<KING>(perspective);
+    Bitboard b = pos.pieces() & ~pos.pieces(KING);
+
+    std::memcpy(acc.values[perspective], FtBiases, sizeof(FtBiases));
+
+    while (b)
+    {
+        Square s = pop_lsb(&b);
+        update_row<true>(acc.values[perspective], FtWeights + feature(perspective, ksq, pos.piece_on(s), s) * HalfDims);
+    }
+  }
+
+
+  // update_accumulator() computes the accumulator of the position, when it is
+  // not already done. For each side we look back for the nearest position
+  // with a computed accumulator and apply the changes of the moves made since
+  // then. We refresh instead if the side has moved its king, whose square all
+  // features depend on, or when there are more changes than pieces on board.
+  // Positions outside of a search have no accumulator of their own and are
+  // computed from scratch into the given one.
+  const Accumulator& update_accumulator(const Position& pos, Accumulator& scratch) {
+
+    StateInfo* st = pos.state();
+
+    if (!st->accumulator)
+    {
+        for (Color c : { WHITE, BLACK })
+            refresh(pos, scratch, c);
+
+        return scratch;
+    }
+
+    if (st->accumulator->computed)
+        return *st->accumulator;
+
+    int budget = popcount(pos.pieces());
+
+    for (Color c : { WHITE, BLACK })
+    {
+        const StateInfo* prev = st;
+        int changes = 0;
+
+        do {
+            const DirtyPiece& dp = prev->dirtyPiece;
+
+            if (   (dp.dirtyNum && dp.piece[0] == make_piece(c, KING))
+                || (changes += dp.dirtyNum) > budget
+                || !prev->previous
+                || !prev->previous->accumulator)
+                prev = nullptr;
+            else
+                prev = prev->previous;
+
+        } while (prev && !prev->accumulator->computed);
+
+        if (!prev)
+        {
+            refresh(pos, *st->accumulator, c);
+            continue;
+        }
+
+        Square ksq = pos.square<KING>(c);
+        int16_t* acc = st->accumulator->values[c];
+
+        std::memcpy(acc, prev->accumulator->values[c], sizeof(prev->accumulator->values[c]));
+
+        for (const StateInfo* s = st; s != prev; s = s->previous)
+            for (int i = 0; i < s->dirtyPiece.dirtyNum; ++i)
+            {
+                const DirtyPiece& dp = s->dirtyPiece;
+
+                if (type_of(dp.piece[i]) == KING)
+                    continue;
+
+                if (dp.from[i] != SQ_NONE)
+                    update_row<false>(acc, FtWeights + feature(c, ksq, dp.piece[i], dp.from[i]) * HalfDims);
+
+                if (dp.to[i] != SQ_NONE)
+                    update_row<true>(acc, FtWeights + feature(c, ksq, dp.piece[i], dp.to[i]) * HalfDims);
+            }
+    }
+
+    st->accumulator->computed = true;
+    return *st->accumulator;
+  }
+
+} // namespace
+
+
+/// load() reads the network parameters from a file, returning false if the
+/// file cannot be read or does not match the network architecture. The whole
+/// file is read and checked before any parameter is overwritten, so that the
+/// network in use is left untouched on failure.
+
+bool load(const std::string& fname) {
+
+  // Size of the parameters in the file, after the header and the description
+  constexpr size_t ParamsSize =  sizeof(int16_t) * HalfDims
+                               + sizeof(int16_t) * FeatureCount * HalfDims
+                               + sizeof(int32_t) * Hidden1Dims
+                               + sizeof(int8_t ) * Hidden1Dims * 2 * HalfDims
+                               + sizeof(int32_t) * Hidden2Dims
+                               + sizeof(int8_t ) * Hidden2Dims * Hidden1Dims
+                               + sizeof(int32_t)
+                               + sizeof(int8_t ) * Hidden2Dims;
+
+  std::ifstream file(fname, std::ios::binary);
+
+  if (!file)
+      return false;
+
+  std::vector<char> buf((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+  size_t pos = 0;
+  uint32_t header[3];
+
+  if (   !read_le<uint32_t>(buf, pos, header, 3)
+      || header[0] != Version
+      || header[1] != ArchHash
+      || buf.size() - pos < header[2]
+      || buf.size() - pos - header[2] != ParamsSize)
+      return false;
+
+  pos += header[2];
+
+  return   read_le<int16_t>(buf, pos, FtBiases, HalfDims)
+        && read_le<int16_t>(buf, pos, FtWeights, size_t(FeatureCount) * HalfDims)
+        && read_le<int32_t>(buf, pos, L1Biases, Hidden1Dims)
+        && read_le<int8_t >(buf, pos, &L1Weights[0][0], Hidden1Dims * 2 * HalfDims)
+        && read_le<int32_t>(buf, pos, L2Biases, Hidden2Dims)
+        && read_le<int8_t >(buf, pos, &L2Weights[0][0], Hidden2Dims * Hidden1Dims)
+        && read_le<int32_t>(buf, pos, &OutBias, 1)
+        && read_le<int8_t >(buf, pos, OutWeights, Hidden2Dims)
+        && pos == buf.size();
+}
+
+
+/// evaluate() returns the network evaluation of the position from the point of
+/// view of the side to move.
+
+Value evaluate(const Position& pos) {
+
+  alignas(64) Activation input[2 * HalfDims];
+  alignas(64) Activation hidden1[Hidden1Dims];
+  alignas(64) Activation hidden2[Hidden2Dims];
+
+  Accumulator scratch;
+
+  transform(update_accumulator(pos, scratch), pos.side_to_move(), input);
+
+  hidden<2 * HalfDims, Hidden1Dims>(input, L1Biases, L1Weights, hidden1);
+  hidden<Hidden1Dims, Hidden2Dims>(hidden1, L2Biases, L2Weights, hidden2);
+
+  return Value((OutBias + dot(hidden2, OutWeights, Hidden2Dims)) / OutputScale);
+}
+
+} // namespace NNUE
+} // namespace Eval
@@ -0,0 +1,73 @@
+/*
+  Stockfish, a UCI chess playing engine derived from Glaurung 2.1
+  Copyright (C) 2004-2008 Tord Romstad (Glaurung author)
+  Copyright (C) 2008-2015 Marco Costalba, Joona Kiiski, Tord Romstad
+  Copyright (C) 2015-2020 Marco Costalba, Joona Kiiski, Gary Linscott, Tord Romstad
+
+  Stockfish is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Stockfish is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef NNUE_H_INCLUDED
+#define NNUE_H_INCLUDED
+
+#include <string>
+
+#include "types.h"
+
+class Position;
+
+namespace Eval {
+namespace NNUE {
+
+/// The network has a first layer of HalfDims neurons for each side, fed by
+/// king-relative piece-square features: the square of the side's own king
+/// combined with the square and the piece of every Met, Khon, Knight, Rook
+/// and Bia on the board. Features are seen from the side's point of view, so
+/// that for black the board is rotated by 180 degrees. The two halves, the
+/// side to move first, go through two small hidden layers to the output.
+
+constexpr int PieceFeatures = 10; // Non-king piece types of both colors
+constexpr int FeatureCount  = SQUARE_NB * PieceFeatures * SQUARE_NB;
+constexpr int HalfDims      = 256;
+constexpr int Hidden1Dims   = 32;
+constexpr int Hidden2Dims   = 32;
+constexpr int StackSize     = MAX_PLY + 10; // Search plies and tablebase probes
+
+/// Accumulator holds the output of the first layer for both sides. Each thread
+/// keeps a stack of them, indexed by the ply from the root of its search, and
+/// StateInfo points to its own slot, so that the classical evaluation does not
+/// pay for copying them. It is derived from the one of the previous position,
+/// using the pieces changed by the move as recorded in DirtyPiece, the first
+/// time the position is evaluated. The slots are kept on cache line
+/// boundaries, which matters for the speed of the row updates.
+
+struct alignas(64) Accumulator {
+  int16_t values[COLOR_NB][HalfDims];
+  bool computed;
+};
+
+struct DirtyPiece {
+  int dirtyNum;
+  Piece piece[3];
+  Square from[3]; // SQ_NONE when the piece is put on the board
+  Square to[3];   // SQ_NONE when the piece is removed from the board
+};
+
+bool load(const std::string& fname);
+Value evaluate(const Position& pos);
+
+} // namespace NNUE
+} // namespace Eval
+
+#endif // #ifndef NNUE_H_INCLUDED
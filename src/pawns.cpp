@@ -182,10 +182,13 @@ void init() {
 Entry* probe(const Position& pos) {
 
   Key key = pos.pawn_key();
-  Entry* e = pos.this_thread()->pawnsTable[key];
+  Table& table = pos.this_thread()->pawnsTable;
+  Entry* e = table[key];
+
+  table.stats.probes++;
 
   if (e->key == key)
-      return e;
+      return table.stats.hits++, e;
 
   e->key = key;
   e->scores[WHITE] = evaluate<WHITE>(pos, e);
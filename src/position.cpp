@@ -588,6 +588,16 @@ void Position::do_move(Move m, StateInfo& newSt, bool givesCheck) {
   assert(captured == NO_PIECE || color_of(captured) == them);
   assert(type_of(captured) != KING);
 
+  // Record the changed pieces for the NNUE accumulator update
+  Eval::NNUE::DirtyPiece& dp = st->dirtyPiece;
+  dp.dirtyNum = 1;
+  dp.piece[0] = pc;
+  dp.from[0] = from;
+  dp.to[0] = to;
+
+  if ((st->accumulator = st->previous->accumulator) != nullptr)
+      (++st->accumulator)->computed = false;
+
   if (captured)
   {
       Square capsq = to;
@@ -599,13 +609,17 @@ void Position::do_move(Move m, StateInfo& newSt, bool givesCheck) {
       else
           st->nonPawnMaterial[them] -= PieceValue[MG][captured];
 
+      dp.dirtyNum = 2;
+      dp.piece[1] = captured;
+      dp.from[1] = capsq;
+      dp.to[1] = SQ_NONE;
+
       // Update board and piece lists
       remove_piece(captured, capsq);
 
-      // Update material hash key and prefetch access to materialTable
+      // Update material hash key
       k ^= Zobrist::psq[captured][capsq];
       st->materialKey ^= Zobrist::psq[captured][pieceCount[captured]];
-      prefetch(thisThread->materialTable[st->materialKey]);
 
       // Reset rule 50 counter
       st->rule50 = 0;
@@ -629,6 +643,12 @@ void Position::do_move(Move m, StateInfo& newSt, bool givesCheck) {
           remove_piece(pc, to);
           put_piece(promotion, to);
 
+          dp.to[0] = SQ_NONE;
+          dp.piece[dp.dirtyNum] = promotion;
+          dp.from[dp.dirtyNum] = SQ_NONE;
+          dp.to[dp.dirtyNum] = to;
+          dp.dirtyNum++;
+
           // Update hash keys
           k ^= Zobrist::psq[pc][to] ^ Zobrist::psq[promotion][to];
           st->pawnKey ^= Zobrist::psq[pc][to];
@@ -721,6 +741,11 @@ void Position::do_null_move(StateInfo& newSt) {
   newSt.previous = st;
   st = &newSt;
 
+  st->dirtyPiece.dirtyNum = 0; // No piece changed, the accumulator is copied
+
+  if (st->accumulator)
+      (++st->accumulator)->computed = false;
+
   st->key ^= Zobrist::side;
   prefetch(TT.first_entry(st->key));
 
@@ -27,6 +27,7 @@
 #include <string>
 
 #include "bitboard.h"
+#include "nnue.h"
 #include "types.h"
 
 
@@ -51,13 +52,20 @@ struct StateInfo {
   Bitboard   blockersForKing[COLOR_NB];
   Bitboard   pinners[COLOR_NB];
   Bitboard   checkSquares[PIECE_TYPE_NB];
+
+  // Used by the NNUE evaluation, the accumulator is computed on demand. It is
+  // a slot of the accumulator stack of the searching thread, nullptr outside
+  // of a search.
+  Eval::NNUE::Accumulator* accumulator;
+  Eval::NNUE::DirtyPiece  dirtyPiece;
 };
 
 /// A list to keep track of the position states along the setup moves (from the
 /// start position to the position just before the search starts). Needed by
 /// 'draw by repetition' detection. Use a std::deque because pointers to
-/// elements are not invalidated upon list resizing.
-typedef std::unique_ptr<std::deque<StateInfo>> StateListPtr;
+/// elements are not invalidated upon list resizing. The list is shared between
+/// the UCI layer, which can keep appending moves to it, and the searching threads.
+typedef std::shared_ptr<std::deque<StateInfo>> StateListPtr;
 
 
 /// Position class stores information regarding the board representation as
@@ -142,6 +150,7 @@ public:
   int game_ply() const;
   bool is_chess960() const;
   Thread* this_thread() const;
+  StateInfo* state() const;
   bool is_draw(int ply) const;
   bool has_game_cycle(int ply) const;
   bool has_repeated() const;
@@ -347,6 +356,10 @@ inline Thread* Position::this_thread() const {
   return thisThread;
 }
 
+inline StateInfo* Position::state() const {
+  return st;
+}
+
 inline void Position::put_piece(Piece pc, Square s) {
 
   board[s] = pc;
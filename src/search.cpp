@@ -48,6 +48,9 @@ namespace Tablebases {
   bool RootInTB;
   bool UseRule50;
   Depth ProbeDepth;
+
+  // Tables are prefetched when the root is this many captures away from them
+  constexpr int PrefetchMargin = 2;
 }
 
 namespace TB = Tablebases;
@@ -116,29 +119,104 @@ namespace {
           : pos.gives_check(move);
   }
 
+  // PerftEntry caches the leaf count of a perft subtree. Entries are shared by
+  // all the threads without locking: the check field stores the key xor-ed with
+  // the count, so that an entry torn by concurrent writes fails verification.
+  struct PerftEntry {
+    Key check;
+    uint64_t count;
+  };
+
+  std::vector<PerftEntry> PerftTable; // Allocated only while running a perft
+
+  constexpr Key PerftDepthKey = 0x9E3779B97F4A7C15ULL; // Mixes depth into the key
+
   // perft() is our utility to verify move generation. All the leaf nodes up
   // to the given depth are generated and counted, and the sum is returned.
-  template<bool Root>
   uint64_t perft(Position& pos, Depth depth) {
 
     StateInfo st;
-    uint64_t cnt, nodes = 0;
+    uint64_t nodes = 0;
     const bool leaf = (depth == 2 * ONE_PLY);
+    const Key key = pos.key() ^ (uint64_t(depth / ONE_PLY) * PerftDepthKey);
+    PerftEntry* e = nullptr;
+
+    if (!PerftTable.empty())
+    {
+        e = &PerftTable[(uint32_t(key) * uint64_t(PerftTable.size())) >> 32];
+
+        if ((e->check ^ e->count) == key)
+            return e->count;
+    }
 
     for (const auto& m : MoveList<LEGAL>(pos))
     {
-        if (Root && depth <= ONE_PLY)
-            cnt = 1, nodes++;
-        else
+        pos.do_move(m, st);
+        nodes += leaf ? MoveList<LEGAL>(pos).size() : perft(pos, depth - ONE_PLY);
+        pos.undo_move(m);
+    }
+
+    if (e)
+        e->check = key ^ nodes, e->count = nodes;
+
+    return nodes;
+  }
+
+  // perft_root() splits the root moves among all the threads, each one working
+  // on its own rootPos, and then prints the leaf count of every root move, in
+  // move generation order, followed by the total. When the 'Perft Hash' option
+  // is set subtree counts are cached in a table shared by the threads.
+  uint64_t perft_root(Depth depth) {
+
+    const MoveList<LEGAL> rootMoves(Threads.main()->rootPos);
+    std::vector<uint64_t> counts(rootMoves.size());
+    std::atomic<size_t> next(0);
+    size_t mbSize = Options["Perft Hash"];
+
+    if (mbSize && depth > 2 * ONE_PLY)
+        PerftTable.assign(mbSize * 1024 * 1024 / sizeof(PerftEntry), PerftEntry());
+
+    auto worker = [&](Thread* th) {
+
+        StateInfo st;
+
+        for (size_t i; (i = next++) < rootMoves.size(); )
         {
-            pos.do_move(m, st);
-            cnt = leaf ? MoveList<LEGAL>(pos).size() : perft<false>(pos, depth - ONE_PLY);
-            nodes += cnt;
-            pos.undo_move(m);
+            Move m = rootMoves.begin()[i];
+
+            if (depth <= ONE_PLY)
+            {
+                counts[i] = 1;
+                continue;
+            }
+
+            th->rootPos.do_move(m, st);
+            counts[i] = depth == 2 * ONE_PLY ? MoveList<LEGAL>(th->rootPos).size()
+                                             : perft(th->rootPos, depth - ONE_PLY);
+            th->rootPos.undo_move(m);
         }
-        if (Root)
-            sync_cout << UCI::move(m) << ": " << cnt << sync_endl;
+    };
+
+    for (Thread* th : Threads)
+        if (th != Threads.main())
+            th->run_custom_job([&worker, th]() { worker(th); });
+
+    worker(Threads.main());
+
+    for (Thread* th : Threads)
+        if (th != Threads.main())
+            th->wait_for_search_finished();
+
+    std::vector<PerftEntry>().swap(PerftTable); // Release the memory
+
+    uint64_t nodes = 0;
+
+    for (size_t i = 0; i < rootMoves.size(); ++i)
+    {
+        nodes += counts[i];
+        sync_cout << UCI::move(rootMoves.begin()[i]) << ": " << counts[i] << sync_endl;
     }
+
     return nodes;
   }
 
@@ -190,8 +268,13 @@ void MainThread::search() {
 
   if (Limits.perft)
   {
-      nodes = perft<true>(rootPos, Limits.perft * ONE_PLY);
-      sync_cout << "\nNodes searched: " << nodes << "\n" << sync_endl;
+      uint64_t cnt = perft_root(Limits.perft * ONE_PLY);
+
+      // Report the leaf count as the searched nodes, e.g. for bench
+      for (Thread* th : Threads)
+          th->nodes = th == this ? cnt : 0;
+
+      sync_cout << "\nNodes searched: " << cnt << "\n" << sync_endl;
       return;
   }
 
@@ -221,9 +304,7 @@ void MainThread::search() {
   // GUI sends a "stop" or "ponderhit" command. We therefore simply wait here
   // until the GUI sends one of those commands (which also raises Threads.stop).
   Threads.stopOnPonderhit = true;
-
-  while (!Threads.stop && (Threads.ponder || Limits.infinite))
-  {} // Busy wait for a stop or a ponder reset
+  Threads.wait_for_stop();
 
   // Stop the threads if not already stopped (also raise the stop if
   // "ponderhit" just reset Threads.ponder).
@@ -283,10 +364,14 @@ void Thread::search() {
   Value bestValue, alpha, beta, delta;
   Move  lastBestMove = MOVE_NONE;
   Depth lastBestMoveDepth = DEPTH_ZERO;
-  MainThread* mainThread = (this == Threads.main() ? Threads.main() : nullptr);
+  MainThread* mainThread = (this == Threads.main() && !independent ? Threads.main() : nullptr);
   double timeReduction = 1.0;
   Color us = rootPos.side_to_move();
   bool failedLow;
+  int failHighs = 0, failLows = 0, researches = 0, bestMoveSwitches = 0;
+  const TTStats ttStart = ttStats;
+  const HashStats pawnsStart = pawnsTable.stats, evalStart = evalCache.stats;
+  const uint64_t faultsStart = major_faults();
 
   std::memset(ss-4, 0, 7 * sizeof(Stack));
   for (int i = 4; i > 0; i--)
@@ -317,10 +402,10 @@ void Thread::search() {
   // Iterative deepening loop until requested to stop or the target depth is reached
   while (   (rootDepth += ONE_PLY) < DEPTH_MAX
          && !Threads.stop
-         && !(Limits.depth && mainThread && rootDepth / ONE_PLY > Limits.depth))
+         && !(Limits.depth && (mainThread || independent) && rootDepth / ONE_PLY > Limits.depth))
   {
       // Distribute search depths across the helper threads
-      if (idx > 0)
+      if (idx > 0 && !independent)
       {
           int i = (idx - 1) % 20;
           if (((rootDepth / ONE_PLY + SkipPhase[i]) / SkipSize[i]) % 2)
@@ -401,6 +486,7 @@ void Thread::search() {
               // re-search, otherwise exit the loop.
               if (bestValue <= alpha)
               {
+                  ++failLows;
                   beta = (alpha + beta) / 2;
                   alpha = std::max(bestValue - delta, -VALUE_INFINITE);
 
@@ -411,10 +497,14 @@ void Thread::search() {
                   }
               }
               else if (bestValue >= beta)
+              {
+                  ++failHighs;
                   beta = std::min(bestValue + delta, VALUE_INFINITE);
+              }
               else
                   break;
 
+              ++researches;
               delta += delta / 4 + 5;
 
               assert(alpha >= -VALUE_INFINITE && beta <= VALUE_INFINITE);
@@ -432,10 +522,40 @@ void Thread::search() {
           completedDepth = rootDepth;
 
       if (rootMoves[0].pv[0] != lastBestMove) {
+         bestMoveSwitches += (lastBestMove != MOVE_NONE);
          lastBestMove = rootMoves[0].pv[0];
          lastBestMoveDepth = rootDepth;
       }
 
+      // Emit one telemetry record per completed iteration and per thread
+      if (!Threads.stop && telemetry_enabled())
+      {
+          TimePoint elapsed = now() - Limits.startTime + 1;
+          uint64_t probes = ttStats.probes - ttStart.probes;
+          uint64_t hits = ttStats.hits - ttStart.hits;
+          uint64_t n = nodes.load(std::memory_order_relaxed);
+          std::stringstream rec;
+
+          rec << "{\"thread\":"          << idx
+              << ",\"depth\":"           << rootDepth / ONE_PLY
+              << ",\"seldepth\":"        << rootMoves[0].selDepth
+              << ",\"nodes\":"           << n
+              << ",\"nps\":"             << n * 1000 / elapsed
+              << ",\"time\":"            << elapsed
+              << ",\"score\":\""         << UCI::value(rootMoves[0].score) << "\""
+              << ",\"tthitrate\":"       << (probes ? double(hits) / probes : 0.0)
+              << ",\"pawnhitrate\":"     << (pawnsTable.stats - pawnsStart).hit_rate()
+              << ",\"evalcachehitrate\":" << (evalCache.stats - evalStart).hit_rate()
+              << ",\"majorfaults\":"     << major_faults() - faultsStart
+              << ",\"failhigh\":"        << failHighs
+              << ",\"faillow\":"         << failLows
+              << ",\"researches\":"      << researches
+              << ",\"bestmovechanges\":" << bestMoveSwitches
+              << ",\"bestmove\":\""      << UCI::move(rootMoves[0].pv[0]) << "\"}";
+
+          telemetry(rec.str());
+      }
+
       // Have we found a "mate in x"?
       if (   Limits.mate
           && bestValue >= VALUE_MATE_IN_MAX_PLY
@@ -483,6 +603,9 @@ void Thread::search() {
           }
   }
 
+  // Page faults that went to disk, mostly from cold tablebase files
+  majorFaults += major_faults() - faultsStart;
+
   if (!mainThread)
       return;
 
@@ -548,7 +671,7 @@ namespace {
     maxValue = VALUE_INFINITE;
 
     // Check for the available remaining time
-    if (thisThread == Threads.main())
+    if (thisThread == Threads.main() && !thisThread->independent)
         static_cast<MainThread*>(thisThread)->check_time();
 
     // Used to send selDepth info to GUI (selDepth counts from 1, ply from 0)
@@ -751,6 +874,8 @@ namespace {
 
         pos.undo_null_move();
 
+        dbg_hit_on(DBG_NULL_MOVE, nullValue >= beta);
+
         if (nullValue >= beta)
         {
             // Do not return unproven mate scores
@@ -860,7 +985,7 @@ moves_loop: // When in check, search starts from here
 
       ss->moveCount = ++moveCount;
 
-      if (rootNode && thisThread == Threads.main() && Time.elapsed() > 3000)
+      if (rootNode && thisThread == Threads.main() && !thisThread->independent && Time.elapsed() > 3000)
           sync_cout << "info depth " << depth / ONE_PLY
                     << " currmove " << UCI::move(move)
                     << " currmovenumber " << moveCount + thisThread->pvIdx << sync_endl;
@@ -896,6 +1021,8 @@ moves_loop: // When in check, search starts from here
           value = search<NonPV>(pos, ss, rBeta - 1, rBeta, depth / 2, cutNode);
           ss->excludedMove = MOVE_NONE;
 
+          dbg_hit_on(DBG_SINGULAR, value < rBeta);
+
           if (value < rBeta)
               extension = ONE_PLY;
       }
@@ -1027,6 +1154,9 @@ moves_loop: // When in check, search starts from here
           value = -search<NonPV>(pos, ss+1, -(alpha+1), -alpha, d, true);
 
           doFullDepthSearch = (value > alpha && d != newDepth);
+
+          dbg_hit_on(DBG_LMR_RESEARCH, doFullDepthSearch);
+          dbg_hist_of(DBG_LMR_REDUCTION, (newDepth - d) / ONE_PLY);
       }
       else
           doFullDepthSearch = !PvNode || moveCount > 1;
@@ -1534,6 +1664,10 @@ void MainThread::check_time() {
   {
       lastInfoTime = tick;
       dbg_print();
+
+      if (Options["TT Stats"])
+          sync_cout << "info string tt " << Threads.tt_stats()
+                    << " hashfull " << TT.hashfull() << sync_endl;
   }
 
   // We should not stop pondering until told so by the GUI
@@ -1648,6 +1782,11 @@ void Tablebases::rank_root_moves(Position& pos, Search::RootMoves& rootMoves) {
         ProbeDepth = DEPTH_ZERO;
     }
 
+    // Start reading the tables in the background when they get within reach
+    if (   Options["SyzygyPrefetch"]
+        && popcount(pos.pieces()) <= Cardinality + PrefetchMargin)
+        prefetch(pos, Cardinality);
+
     if (Cardinality >= popcount(pos.pieces()))
     {
         // Rank moves using DTZ tables
@@ -19,6 +19,7 @@
 
 #include <algorithm>
 #include <atomic>
+#include <cctype>    // For std::tolower
 #include <cstdint>
 #include <cstring>   // For std::memset and std::memcpy
 #include <deque>
@@ -26,7 +27,9 @@
 #include <iostream>
 #include <list>
 #include <sstream>
+#include <thread>
 #include <type_traits>
+#include <unordered_map>
 
 #include "../bitboard.h"
 #include "../movegen.h"
@@ -39,6 +42,7 @@
 #include "tbprobe.h"
 
 #ifndef _WIN32
+#include <dirent.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <sys/mman.h>
@@ -58,7 +62,7 @@ namespace {
 constexpr int TBPIECES = 6; // Max number of supported pieces
 
 enum { BigEndian, LittleEndian };
-enum TBType { KEY, WDL, DTZ }; // Used as template parameter
+enum TBType { KEY, WDL, DTZ, MTB }; // Used as template parameter
 
 // Each table has a set of flags: all of them refer to DTZ tables, the last one to WDL tables
 enum TBFlag { STM = 1, Mapped = 2, WinPlies = 4, LossPlies = 8, SingleValue = 128 };
@@ -167,38 +171,48 @@ static_assert(sizeof(LR) == 3, "LR tree entry must be 3 bytes");
 
 // class TBFile memory maps/unmaps the single .rtbw and .rtbz files. Files are
 // memory mapped for best performance. Files are mapped at first access: at init
-// time only existence of the file is checked.
+// time only existence of the file is checked, in the index of the files found
+// in the Paths directories.
 class TBFile : public std::ifstream {
 
     std::string fname;
 
 public:
-    // Look for and open the file among the Paths directories where the .rtbw
-    // and .rtbz files can be found. Multiple directories are separated by ";"
-    // on Windows and by ":" on Unix-based operating systems.
+    // Directories where the .rtbw, .rtbz and .mtb files can be found. Multiple
+    // directories are separated by ";" on Windows and by ":" on Unix-based
+    // operating systems.
     //
     // Example:
     // C:\tb\wdl345;C:\tb\wdl6;D:\tb\dtz345;D:\tb\dtz6
     static std::string Paths;
 
-    TBFile(const std::string& f) {
+    // Full path of each file found by scan(), the first directory of Paths
+    // taking precedence as when looking for the file in turn in each of them.
+    // Files are indexed by folded name, see fold().
+    static std::unordered_map<std::string, std::string> Files;
 
-#ifndef _WIN32
-        constexpr char SepChar = ':';
-#else
-        constexpr char SepChar = ';';
+    // File names are matched regardless of case where the file system does so
+    // by default, as the direct open of each file did before the index.
+    static std::string fold(std::string f) {
+#if defined(_WIN32) || defined(__APPLE__)
+        std::transform(f.begin(), f.end(), f.begin(), [](char c) { return char(std::tolower(c)); });
 #endif
-        std::stringstream ss(Paths);
-        std::string path;
+        return f;
+    }
+
+    TBFile(const std::string& f) {
 
-        while (std::getline(ss, path, SepChar)) {
-            fname = path + "/" + f;
+        auto it = Files.find(fold(f));
+
+        if (it != Files.end()) {
+            fname = it->second;
             std::ifstream::open(fname);
-            if (is_open())
-                return;
         }
     }
 
+    static bool exists(const std::string& f) { return Files.count(fold(f)); }
+    static void scan();
+
     // Memory map the file and check it. File should be already open and will be
     // closed after mapping.
     uint8_t* map(void** baseAddress, uint64_t* mapping, TBType type) {
@@ -252,9 +266,10 @@ public:
         uint8_t* data = (uint8_t*)*baseAddress;
 
         constexpr uint8_t Magics[][4] = { { 0xD7, 0x66, 0x0C, 0xA5 },
-                                          { 0x71, 0xE8, 0x23, 0x5D } };
+                                          { 0x71, 0xE8, 0x23, 0x5D },
+                                          { 0x4D, 0x54, 0x42, 0x02 } }; // "MTB", version 2
 
-        if (memcmp(data, Magics[type == WDL], 4)) {
+        if (memcmp(data, Magics[type == MTB ? 2 : type == WDL], 4)) {
             std::cerr << "Corrupted table in file " << fname << std::endl;
             unmap(*baseAddress, *mapping);
             return *baseAddress = nullptr, nullptr;
@@ -275,6 +290,76 @@ public:
 };
 
 std::string TBFile::Paths;
+std::unordered_map<std::string, std::string> TBFile::Files;
+
+// Returns the names of the regular files in the directory, symbolic links to
+// them included, empty if it cannot be read. So ".", ".." and subdirectories
+// are left out.
+std::vector<std::string> list_directory(const std::string& path) {
+
+    std::vector<std::string> names;
+
+#ifndef _WIN32
+    if (DIR* dir = opendir(path.c_str())) {
+        while (dirent* entry = readdir(dir)) {
+            struct stat statbuf;
+
+            if (   entry->d_type == DT_REG
+                || (   (entry->d_type == DT_LNK || entry->d_type == DT_UNKNOWN)
+                    && !stat((path + "/" + entry->d_name).c_str(), &statbuf)
+                    && S_ISREG(statbuf.st_mode)))
+                names.push_back(entry->d_name);
+        }
+
+        closedir(dir);
+    }
+#else
+    WIN32_FIND_DATA data;
+    HANDLE h = FindFirstFile((path + "\\*").c_str(), &data);
+
+    if (h != INVALID_HANDLE_VALUE) {
+        do if (!(data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY))
+               names.push_back(data.cFileName);
+        while (FindNextFile(h, &data));
+
+        FindClose(h);
+    }
+#endif
+
+    return names;
+}
+
+// Lists once the Paths directories, each one in its own thread, because they
+// may be on slow or network storage, and builds the index of the files.
+void TBFile::scan() {
+
+#ifndef _WIN32
+    constexpr char SepChar = ':';
+#else
+    constexpr char SepChar = ';';
+#endif
+    std::stringstream ss(Paths);
+    std::vector<std::string> paths;
+    std::string path;
+
+    while (std::getline(ss, path, SepChar))
+        paths.push_back(path);
+
+    std::vector<std::vector<std::string>> names(paths.size());
+    std::vector<std::thread> threads;
+
+    for (size_t i = 0; i < paths.size(); ++i)
+        threads.emplace_back([&, i]() { names[i] = list_directory(paths[i]); });
+
+    for (std::thread& th : threads)
+        th.join();
+
+    Files.clear();
+
+    for (size_t i = 0; i < paths.size(); ++i)
+        for (const std::string& name : names[i])
+            Files.emplace(fold(name), paths[i] + "/" + name); // Keeps the first one
+}
 
 // struct PairsData contains low level indexing information to access TB data.
 // There are 8, 4 or 2 PairsData records for each TBTable, according to type of
@@ -321,13 +406,16 @@ struct TBTable {
     bool hasPawns;
     bool hasUniquePieces;
     uint8_t pawnCount[2]; // [Lead color / other color]
+    uint8_t material[COLOR_NB][PIECE_TYPE_NB]; // Piece counts for key
+    bool warmedUp;
+    std::string name; // Like "KRvK", the file name without extension
     PairsData items[Sides][4]; // [wtm / btm][FILE_A..FILE_D or 0]
 
     PairsData* get(int stm, int f) {
         return &items[stm % Sides][hasPawns ? f : 0];
     }
 
-    TBTable() : ready(false), baseAddress(nullptr) {}
+    TBTable() : ready(false), baseAddress(nullptr), warmedUp(false) {}
     explicit TBTable(const std::string& code);
     explicit TBTable(const TBTable<WDL>& wdl);
 
@@ -337,15 +425,25 @@ struct TBTable {
     }
 };
 
+// Piece counts of a table, used to find the tables reachable from a position
+void set_material(uint8_t material[][PIECE_TYPE_NB], const Position& pos) {
+
+    for (Color c = WHITE; c <= BLACK; ++c)
+        for (PieceType pt = PAWN; pt <= KING; ++pt)
+            material[c][pt] = uint8_t(popcount(pos.pieces(c, pt)));
+}
+
 template<>
 TBTable<WDL>::TBTable(const std::string& code) : TBTable() {
 
     StateInfo st;
     Position pos;
 
+    name = code;
     key = pos.set(code, WHITE, &st).material_key();
     pieceCount = pos.count<ALL_PIECES>();
     hasPawns = pos.pieces(PAWN);
+    set_material(material, pos);
 
     hasUniquePieces = false;
     for (Color c = WHITE; c <= BLACK; ++c)
@@ -369,6 +467,7 @@ template<>
 TBTable<DTZ>::TBTable(const TBTable<WDL>& wdl) : TBTable() {
 
     // Use the corresponding WDL table to avoid recalculating all from scratch
+    name = wdl.name;
     key = wdl.key;
     key2 = wdl.key2;
     pieceCount = wdl.pieceCount;
@@ -378,6 +477,50 @@ TBTable<DTZ>::TBTable(const TBTable<WDL>& wdl) : TBTable() {
     pawnCount[1] = wdl.pawnCount[1];
 }
 
+// struct MakrukTable holds a Makruk tablebase, as written by Bitbases::generate().
+// After the magic number, which ends with the format version, the file holds
+// the number of men, a DenseTable flag, two zero bytes and the number of
+// entries as a 64 bit integer. A sparse table then holds the won and lost
+// positions, sorted, as little endian 64 bit integers index << 16 | value, where
+// the index is given by Bitbases::index() and the value is win << 15 | (dtc + 1),
+// dtc being the number of plies to the next capture, promotion or mate. The
+// positions not found are draws. Tables where most positions are decisive are
+// dense instead and hold the 16 bit value of every position, zero for a draw.
+// The format covers up to 6 men, although only tables of 3 and 4 men are
+// generated yet. Like the Syzygy ones, the file is memory mapped at first
+// access.
+struct MakrukTable {
+    std::atomic_bool ready;
+    void* baseAddress;
+    uint8_t* data;
+    uint64_t mapping;
+    Key key;
+    Key key2;
+    int pieceCount;
+    uint8_t material[COLOR_NB][PIECE_TYPE_NB];
+    bool warmedUp;
+    std::string fname;
+
+    explicit MakrukTable(const std::string& code);
+
+    ~MakrukTable() {
+        if (baseAddress)
+            TBFile::unmap(baseAddress, mapping);
+    }
+};
+
+MakrukTable::MakrukTable(const std::string& code)
+    : ready(false), baseAddress(nullptr), warmedUp(false), fname(code + ".mtb") {
+
+    StateInfo st;
+    Position pos;
+
+    key = pos.set(code, WHITE, &st).material_key();
+    pieceCount = pos.count<ALL_PIECES>();
+    set_material(material, pos);
+    key2 = pos.set(code, BLACK, &st).material_key();
+}
+
 // class TBTables creates and keeps ownership of the TBTable objects, one for
 // each TB file found. It supports a fast, hash based, table lookup. Populated
 // at init time, accessed at probe time.
@@ -392,6 +535,9 @@ class TBTables {
     std::deque<TBTable<WDL>> wdlTable;
     std::deque<TBTable<DTZ>> dtzTable;
 
+    std::pair<Key, MakrukTable*> makrukHashTable[Size];
+    std::deque<MakrukTable> makrukTable;
+
     void insert(Key key, TBTable<WDL>* wdl, TBTable<DTZ>* dtz) {
         Entry* entry = &hashTable[(uint32_t)key & (Size - 1)];
 
@@ -405,6 +551,17 @@ class TBTables {
         exit(1);
     }
 
+    void insert(Key key, MakrukTable* e) {
+        auto* entry = &makrukHashTable[(uint32_t)key & (Size - 1)];
+
+        while (entry->second && entry->first != key)
+            if (++entry - makrukHashTable == Size - 1) {
+                std::cerr << "TB hash table size too low!" << std::endl;
+                exit(1);
+            }
+        *entry = std::make_pair(key, e);
+    }
+
 public:
     template<TBType Type>
     TBTable<Type>* get(Key key) {
@@ -414,13 +571,24 @@ public:
         }
     }
 
+    MakrukTable* makruk(Key key) {
+        for (const auto* entry = &makrukHashTable[(uint32_t)key & (Size - 1)]; ; ++entry)
+            if (entry->first == key || !entry->second)
+                return entry->second;
+    }
+
     void clear() {
         memset(hashTable, 0, sizeof(hashTable));
         wdlTable.clear();
         dtzTable.clear();
+        std::fill(makrukHashTable, makrukHashTable + Size, std::make_pair(Key(0), nullptr));
+        makrukTable.clear();
     }
-    size_t size() const { return wdlTable.size(); }
+    size_t size() const { return wdlTable.size() + makrukTable.size(); }
     void add(const std::vector<PieceType>& pieces);
+    void add_makruk(const std::string& code);
+    void cold_tables(const Position& pos, int cardinality, std::vector<TBTable<WDL>*>& wdl,
+                     std::vector<TBTable<DTZ>*>& dtz, std::vector<MakrukTable*>& makruk);
 };
 
 TBTables TBTables;
@@ -434,13 +602,11 @@ void TBTables::add(const std::vector<PieceType>& pieces) {
     for (PieceType pt : pieces)
         code += PieceToChar[pt];
 
-    TBFile file(code.insert(code.find('K', 1), "v") + ".rtbw"); // KRK -> KRvK
+    code.insert(code.find('K', 1), "v"); // KRK -> KRvK
 
-    if (!file.is_open()) // Only WDL file is checked
+    if (!TBFile::exists(code + ".rtbw")) // Only WDL file is checked
         return;
 
-    file.close();
-
     MaxCardinality = std::max((int)pieces.size(), MaxCardinality);
 
     wdlTable.emplace_back(code);
@@ -451,6 +617,21 @@ void TBTables::add(const std::vector<PieceType>& pieces) {
     insert(wdlTable.back().key2, &wdlTable.back(), &dtzTable.back());
 }
 
+// If the Makruk table of the given code exists, a new MakrukTable is created
+// and added to the list and the hash table. Called at init time.
+void TBTables::add_makruk(const std::string& code) {
+
+    if (!TBFile::exists(code + ".mtb"))
+        return;
+
+    makrukTable.emplace_back(code);
+
+    MaxCardinality = std::max(makrukTable.back().pieceCount, MaxCardinality);
+
+    insert(makrukTable.back().key , &makrukTable.back());
+    insert(makrukTable.back().key2, &makrukTable.back());
+}
+
 // TB tables are compressed with canonical Huffman code. The compressed data is divided into
 // blocks of size d->sizeofBlock, and each block stores a variable number of symbols.
 // Each symbol represents either a WDL or a (remapped) DTZ value, or a pair of other symbols
@@ -1070,12 +1251,12 @@ void set(T& e, uint8_t* data) {
         }
 }
 
-// If the TB file corresponding to the given position is already memory mapped
-// then return its base address, otherwise try to memory map and init it. Called
-// at every probe, memory map and init only at first access. Function is thread
-// safe and can be called concurrently.
+// If the TB file of the given table is already memory mapped then return its
+// base address, otherwise try to memory map and init it. Called at every probe,
+// memory map and init only at first access. Function is thread safe and can be
+// called concurrently.
 template<TBType Type>
-void* mapped(TBTable<Type>& e, const Position& pos) {
+void* mapped(TBTable<Type>& e) {
 
     static Mutex mutex;
 
@@ -1089,16 +1270,7 @@ void* mapped(TBTable<Type>& e, const Position& pos) {
     if (e.ready.load(std::memory_order_relaxed)) // Recheck under lock
         return e.baseAddress;
 
-    // Pieces strings in decreasing order for each color, like ("KPP","KR")
-    std::string fname, w, b;
-    for (PieceType pt = KING; pt >= PAWN; --pt) {
-        w += std::string(popcount(pos.pieces(WHITE, pt)), PieceToChar[pt]);
-        b += std::string(popcount(pos.pieces(BLACK, pt)), PieceToChar[pt]);
-    }
-
-    fname =  (e.key == pos.material_key() ? w + 'v' + b : b + 'v' + w)
-           + (Type == WDL ? ".rtbw" : ".rtbz");
-
+    std::string fname = e.name + (Type == WDL ? ".rtbw" : ".rtbz");
     uint8_t* data = TBFile(fname).map(&e.baseAddress, &e.mapping, Type);
 
     if (data)
@@ -1108,6 +1280,109 @@ void* mapped(TBTable<Type>& e, const Position& pos) {
     return e.baseAddress;
 }
 
+constexpr uint8_t DenseTable = 1;
+constexpr size_t MakrukHeader = 16; // Including the magic number
+
+void* mapped(MakrukTable& e) {
+
+    static Mutex mutex;
+
+    if (e.ready.load(std::memory_order_acquire))
+        return e.baseAddress;
+
+    std::unique_lock<Mutex> lk(mutex);
+
+    if (e.ready.load(std::memory_order_relaxed))
+        return e.baseAddress;
+
+    // Check the header and the size of the file before trusting the indices,
+    // 2 bytes for every position of a dense table and 8 bytes for each won or
+    // lost one otherwise, so that a truncated or mismatched file cannot be read
+    // past its end.
+    TBFile file(e.fname);
+    uint64_t size = file.is_open() ? uint64_t(file.seekg(0, std::ios::end).tellg()) : 0;
+    uint64_t positions = uint64_t(2 * 32 * 64) << (6 * (e.pieceCount - 2));
+
+    if (size >= MakrukHeader)
+        e.data = file.map(&e.baseAddress, &e.mapping, MTB);
+    else
+        e.data = nullptr, e.baseAddress = nullptr;
+
+    if (   e.data
+        && (   e.data[0] != e.pieceCount
+            || e.data[1] > DenseTable
+            || size != MakrukHeader + (e.data[1] == DenseTable ? 2 * positions
+                                                               : 8 * number<uint64_t, LittleEndian>(e.data + 4))
+            || (e.data[1] == DenseTable && number<uint64_t, LittleEndian>(e.data + 4) != positions)))
+    {
+        std::cerr << "Corrupted table in file " << e.fname << std::endl;
+        TBFile::unmap(e.baseAddress, e.mapping);
+        e.data = nullptr, e.baseAddress = nullptr;
+    }
+
+    e.ready.store(true, std::memory_order_release);
+    return e.baseAddress;
+}
+
+// Probe the Makruk table of the position, if any. Returns false when there is
+// none, otherwise sets the WDL score and the distance to conversion as seen by
+// the side to move. Makruk tables hold the exact result of every position, so
+// that, unlike with the Syzygy ones, captures need not be searched.
+bool probe_makruk(const Position& pos, WDLScore* wdl, int* dtc) {
+
+    MakrukTable* e = TBTables.makruk(pos.material_key());
+
+    if (!e || !mapped(*e))
+        return false;
+
+    // Look at the position with the colors flipped when the table is the one
+    // of the other side, like KSvKN for KNvKS.
+    bool flip = pos.material_key() != e->key;
+    Color stm = flip ? ~pos.side_to_move() : pos.side_to_move();
+    Square ksq[] = { pos.square<KING>(flip ? BLACK : WHITE), pos.square<KING>(flip ? WHITE : BLACK) };
+    Piece pc[] = { NO_PIECE, NO_PIECE };
+    Square sq[] = { SQ_NONE, SQ_NONE };
+    Bitboard b = pos.pieces() ^ pos.pieces(KING);
+
+    for (int i = 0; b; ++i)
+    {
+        sq[i] = pop_lsb(&b);
+        pc[i] = flip ? ~pos.piece_on(sq[i]) : pos.piece_on(sq[i]);
+        sq[i] = flip ? ~sq[i] : sq[i];
+    }
+
+    if (flip)
+        ksq[WHITE] = ~ksq[WHITE], ksq[BLACK] = ~ksq[BLACK];
+
+    uint64_t idx = Bitbases::index(stm, ksq[WHITE], ksq[BLACK], pc[0], sq[0], pc[1], sq[1]);
+    uint8_t* entries = e->data + MakrukHeader - 4;
+    uint64_t count = number<uint64_t, LittleEndian>(e->data + 4), lo = 0, hi = count;
+    uint16_t v = 0;
+
+    if (e->data[1] == DenseTable)
+        v = number<uint16_t, LittleEndian>(entries + 2 * idx);
+    else
+    {
+        // Binary search of the first entry not below the index
+        while (lo < hi)
+        {
+            uint64_t mid = (lo + hi) / 2;
+
+            if (number<uint64_t, LittleEndian>(entries + 8 * mid) >> 16 < idx)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+
+        if (lo < count && number<uint64_t, LittleEndian>(entries + 8 * lo) >> 16 == idx)
+            v = uint16_t(number<uint64_t, LittleEndian>(entries + 8 * lo));
+    }
+
+    *wdl = !v ? WDLDraw : v & 0x8000 ? WDLWin : WDLLoss;
+    *dtc = v ? (v & 0x7FFF) - 1 : 0;
+    return true;
+}
+
 template<TBType Type, typename Ret = typename TBTable<Type>::Ret>
 Ret probe_table(const Position& pos, ProbeState* result, WDLScore wdl = WDLDraw) {
 
@@ -1116,7 +1391,7 @@ Ret probe_table(const Position& pos, ProbeState* result, WDLScore wdl = WDLDraw)
 
     TBTable<Type>* entry = TBTables.get<Type>(pos.material_key());
 
-    if (!entry || !mapped(*entry, pos))
+    if (!entry || !mapped(*entry))
         return *result = FAIL, Ret();
 
     return do_probe_table(pos, entry, wdl, result);
@@ -1197,21 +1472,169 @@ WDLScore search(Position& pos, ProbeState* result) {
     return *result = OK, value;
 }
 
+// A table can be reached from a position when each side has at most as many
+// pieces of each type, a Met being possibly a promoted Bia. The colors of the
+// table may be flipped.
+bool reachable(const Position& pos, const uint8_t material[][PIECE_TYPE_NB]) {
+
+    for (int flip = 0; flip < 2; ++flip)
+    {
+        bool ok = true;
+
+        for (Color c = WHITE; c <= BLACK; ++c)
+        {
+            const uint8_t* m = material[flip ? ~c : c];
+            int promotable = popcount(pos.pieces(c, QUEEN, PAWN));
+
+            ok &=    m[PAWN] <= popcount(pos.pieces(c, PAWN))
+                  && m[QUEEN] + m[PAWN] <= promotable
+                  && m[BISHOP] <= popcount(pos.pieces(c, BISHOP))
+                  && m[KNIGHT] <= popcount(pos.pieces(c, KNIGHT))
+                  && m[ROOK] <= popcount(pos.pieces(c, ROOK));
+        }
+
+        if (ok)
+            return true;
+    }
+
+    return false;
+}
+
+// Collects the tables, with up to cardinality pieces, that can be reached from
+// the position and have not been warmed up yet, and marks them as warmed up.
+void TBTables::cold_tables(const Position& pos, int cardinality, std::vector<TBTable<WDL>*>& wdl,
+                           std::vector<TBTable<DTZ>*>& dtz, std::vector<MakrukTable*>& makruk) {
+
+    for (size_t i = 0; i < wdlTable.size(); ++i)
+        if (   !wdlTable[i].warmedUp
+            && wdlTable[i].pieceCount <= cardinality
+            && reachable(pos, wdlTable[i].material))
+        {
+            wdlTable[i].warmedUp = true;
+            wdl.push_back(&wdlTable[i]);
+            dtz.push_back(&dtzTable[i]);
+        }
+
+    for (MakrukTable& e : makrukTable)
+        if (   !e.warmedUp
+            && e.pieceCount <= cardinality
+            && reachable(pos, e.material))
+        {
+            e.warmedUp = true;
+            makruk.push_back(&e);
+        }
+}
+
+// struct WarmUp runs the thread that reads in advance the pages of the tables
+// selected by Tablebases::prefetch(), so that the search threads do not stall
+// on the first probes of a cold file. Declared after TBTables, so that it is
+// destroyed, and its thread joined, before the tables are unmapped.
+struct WarmUp {
+
+    std::thread thread;
+    std::atomic_bool stop, running;
+
+    WarmUp() : stop(false), running(false) {}
+    ~WarmUp() { join(); }
+
+    void join() {
+        stop = true;
+        if (thread.joinable())
+            thread.join();
+        stop = false;
+    }
+};
+
+WarmUp Warmer;
+
+// Maps the file of the table when needed and asks the kernel to read it ahead,
+// then touches one byte in every page so that the pages are also mapped in the
+// process.
+template<typename T>
+void warm_up(T& e) {
+
+#ifndef _WIN32
+    if (!mapped(e))
+        return;
+
+    void* baseAddress = e.baseAddress;
+    uint64_t mapping = e.mapping;
+
+    const uint64_t pageSize = uint64_t(sysconf(_SC_PAGESIZE));
+    const volatile uint8_t* data = (uint8_t*)baseAddress;
+    uint8_t sum = 0;
+
+    madvise(baseAddress, mapping, MADV_WILLNEED);
+
+    for (uint64_t i = 0; i < mapping && !Warmer.stop; i += pageSize)
+        sum += data[i];
+
+    (void)sum;
+#else
+    (void)e; // The mapping is a handle on Windows
+#endif
+}
+
 } // namespace
 
 
+/// Tablebases::prefetch() starts reading in the background the tables, with up
+/// to cardinality pieces, that the search may probe from the given position.
+/// Each table is read once, and nothing is started while a previous warm-up is
+/// still running.
+
+void Tablebases::prefetch(const Position& pos, int cardinality) {
+
+    if (Warmer.running)
+        return;
+
+    std::vector<TBTable<WDL>*> wdl;
+    std::vector<TBTable<DTZ>*> dtz;
+    std::vector<MakrukTable*> makruk;
+
+    TBTables.cold_tables(pos, cardinality, wdl, dtz, makruk);
+
+    if (wdl.empty() && makruk.empty())
+        return;
+
+    Warmer.join();
+    Warmer.running = true;
+    Warmer.thread = std::thread([=]() {
+
+        for (size_t i = 0; i < wdl.size(); ++i)
+        {
+            warm_up(*wdl[i]);
+            warm_up(*dtz[i]);
+        }
+
+        for (MakrukTable* e : makruk)
+            warm_up(*e);
+
+        Warmer.running = false;
+    });
+}
+
+
 /// Tablebases::init() is called at startup and after every change to
-/// "SyzygyPath" UCI option to (re)create the various tables. It is not thread
+/// "SyzygyPath" UCI option to (re)create the various tables. Directories are
+/// listed once, and a table is only looked up in the resulting index, the file
+/// being opened and its headers parsed at the first probe. It is not thread
 /// safe, nor it needs to be.
 void Tablebases::init(const std::string& paths) {
 
+    Warmer.join();
     TBTables.clear();
+    TBFile::Files.clear();
     MaxCardinality = 0;
     TBFile::Paths = paths;
 
     if (paths.empty() || paths == "<empty>")
         return;
 
+    TimePoint elapsed = now();
+
+    TBFile::scan();
+
     // MapB1H1H7[] encodes a square below a1-h8 diagonal to 0..27
     int code = 0;
     for (Square s = SQ_A1; s <= SQ_H8; ++s)
@@ -1333,7 +1756,20 @@ void Tablebases::init(const std::string& paths) {
         }
     }
 
-    sync_cout << "info string Found " << TBTables.size() << " tablebases" << sync_endl;
+    // Add the Makruk tables, named like KNKS.mtb, of up to four pieces
+    const std::string Makruk = " PMSNRK";
+
+    for (PieceType p1 = PAWN; p1 < KING; ++p1) {
+        TBTables.add_makruk(std::string("K") + Makruk[p1] + "K");
+
+        for (PieceType p2 = PAWN; p2 <= p1; ++p2) {
+            TBTables.add_makruk(std::string("K") + Makruk[p1] + Makruk[p2] + "K");
+            TBTables.add_makruk(std::string("K") + Makruk[p1] + "K" + Makruk[p2]);
+        }
+    }
+
+    sync_cout << "info string Found " << TBTables.size() << " tablebases in "
+              << now() - elapsed << "ms" << sync_endl;
 }
 
 // Probe the WDL table for a particular position.
@@ -1346,7 +1782,14 @@ void Tablebases::init(const std::string& paths) {
 //  2 : win
 WDLScore Tablebases::probe_wdl(Position& pos, ProbeState* result) {
 
+    WDLScore wdl;
+    int dtc;
+
     *result = OK;
+
+    if (probe_makruk(pos, &wdl, &dtc))
+        return wdl;
+
     return search<false>(pos, result);
 }
 
@@ -1378,8 +1821,17 @@ WDLScore Tablebases::probe_wdl(Position& pos, ProbeState* result) {
 // then do not accept moves leading to dtz + 50-move-counter == 100.
 int Tablebases::probe_dtz(Position& pos, ProbeState* result) {
 
+    int dtc;
+    WDLScore wdl;
+
     *result = OK;
-    WDLScore wdl = search<true>(pos, result);
+
+    // Makruk tables give the distance to conversion, the next capture, promotion
+    // or mate, that is returned as a DTZ, a mated side getting -1.
+    if (probe_makruk(pos, &wdl, &dtc))
+        return wdl == WDLWin ? dtc : wdl == WDLLoss ? -std::max(dtc, 1) : 0;
+
+    wdl = search<true>(pos, result);
 
     if (*result == FAIL || wdl == WDLDraw) // DTZ tables don't store draws
         return 0;
@@ -1446,9 +1898,19 @@ bool Tablebases::root_probe(Position& pos, Search::RootMoves& rootMoves) {
 
     ProbeState result;
     StateInfo st;
+    WDLScore wdl;
+    int dtc;
+
+    // Makruk tables count the plies to the next capture or promotion, and a Bia
+    // push, which resets the 50-move counter, is no conversion. So for them a
+    // move zeroes the distance only when it changes the material, and the
+    // 50-move counter is not taken into account: Syzygy50MoveRule does not
+    // apply to Makruk tables.
+    bool makruk = probe_makruk(pos, &wdl, &dtc);
+    Key materialKey = pos.material_key();
 
     // Obtain 50-move counter for the root position
-    int cnt50 = pos.rule50_count();
+    int cnt50 = makruk ? 0 : pos.rule50_count();
 
     // Check whether a position was repeated since the last zeroing move.
     bool rep = pos.has_repeated();
@@ -1461,10 +1923,10 @@ bool Tablebases::root_probe(Position& pos, Search::RootMoves& rootMoves) {
         pos.do_move(m.pv[0], st);
 
         // Calculate dtz for the current move counting from the root position
-        if (pos.rule50_count() == 0)
+        if (makruk ? pos.material_key() != materialKey : pos.rule50_count() == 0)
         {
             // In case of a zeroing move, dtz is one of -101/-1/0/1/101
-            WDLScore wdl = -probe_wdl(pos, &result);
+            wdl = -probe_wdl(pos, &result);
             dtz = dtz_before_zeroing(wdl);
         }
         else
@@ -52,6 +52,7 @@ int probe_dtz(Position& pos, ProbeState* result);
 bool root_probe(Position& pos, Search::RootMoves& rootMoves);
 bool root_probe_wdl(Position& pos, Search::RootMoves& rootMoves);
 void rank_root_moves(Position& pos, Search::RootMoves& rootMoves);
+void prefetch(const Position& pos, int cardinality);
 
 inline std::ostream& operator<<(std::ostream& os, const WDLScore v) {
 
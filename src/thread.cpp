@@ -20,6 +20,8 @@
 
 #include <algorithm> // For std::count
 #include <cassert>
+#include <cstdlib>
+#include <iostream>
 
 #include "movegen.h"
 #include "search.h"
@@ -32,7 +34,8 @@ ThreadPool Threads; // Global object
 
 
 /// Thread constructor launches the thread and waits until it goes to sleep
-/// in idle_loop(). Note that 'searching' and 'exit' should be alredy set.
+/// in idle_loop(), after having allocated its tables. Note that 'searching'
+/// and 'exit' should be alredy set.
 
 Thread::Thread(size_t n) : idx(n), stdThread(&Thread::idle_loop, this) {
 
@@ -50,6 +53,8 @@ Thread::~Thread() {
   exit = true;
   start_searching();
   stdThread.join();
+
+  aligned_free(accumulators);
 }
 
 
@@ -57,6 +62,11 @@ Thread::~Thread() {
 
 void Thread::clear() {
 
+  independent = false;
+  ttStats = TTStats();
+  evalCache.clear();
+  pawnsTable.stats = evalCache.stats = HashStats();
+  majorFaults = 0;
   counterMoves.fill(MOVE_NONE);
   mainHistory.fill(0);
   captureHistory.fill(0);
@@ -78,6 +88,19 @@ void Thread::start_searching() {
 }
 
 
+/// Thread::run_custom_job() wakes up the thread to execute the given function
+/// instead of a search. Use wait_for_search_finished() to wait for completion.
+
+void Thread::run_custom_job(std::function<void()> f) {
+
+  std::unique_lock<Mutex> lk(mutex);
+  cv.wait(lk, [&]{ return !searching; });
+  jobFunc = std::move(f);
+  searching = true;
+  cv.notify_one(); // Wake up the thread in idle_loop()
+}
+
+
 /// Thread::wait_for_search_finished() blocks on the condition variable
 /// until the thread has finished searching.
 
@@ -101,6 +124,26 @@ void Thread::idle_loop() {
   if (Options["Threads"] >= 8)
       WinProcGroup::bindThisThread(idx);
 
+  CpuBinding::bindThisThread(idx, Options["Thread Binding"]);
+
+  // Allocate and first-touch the per-thread tables from the thread itself,
+  // after binding, so that on NUMA systems they end up in local memory.
+  pawnsTable.init(size_t(Options["Pawn Hash Entries"]));
+  evalCache.init(size_t(Options["Eval Cache"]) * 1024 * 1024 / sizeof(Eval::CacheEntry));
+
+  accumulators = (Eval::NNUE::Accumulator*)aligned_malloc(
+                  Eval::NNUE::StackSize * sizeof(Eval::NNUE::Accumulator));
+
+  if (!accumulators)
+  {
+      std::cerr << "Failed to allocate the NNUE accumulator stack." << std::endl;
+      std::exit(EXIT_FAILURE);
+  }
+
+  clear();
+
+  TranspositionTable::bind_stats(&ttStats);
+
   while (true)
   {
       std::unique_lock<Mutex> lk(mutex);
@@ -111,9 +154,15 @@ void Thread::idle_loop() {
       if (exit)
           return;
 
+      std::function<void()> job = std::move(jobFunc);
+      jobFunc = nullptr;
+
       lk.unlock();
 
-      search();
+      if (job)
+          job();
+      else
+          search();
   }
 }
 
@@ -136,10 +185,10 @@ void ThreadPool::set(size_t requested) {
       while (size() < requested)
           push_back(new Thread(size()));
       clear();
-  }
 
-  // Reallocate the hash with the new threadpool size
-  TT.resize(Options["Hash"]);
+      // Reallocate the hash with the new threadpool size
+      TT.resize(Options["Hash"]);
+  }
 }
 
 /// ThreadPool::clear() sets threadPool data to initial values.
@@ -154,6 +203,150 @@ void ThreadPool::clear() {
   main()->previousTimeReduction = 1.0;
 }
 
+/// ThreadPool::analyze() searches each of the given positions up to the given
+/// depth. Positions are distributed among the threads, each running a single
+/// threaded search on its own root position, so that the work scales with the
+/// number of threads, and a result line is printed as soon as a position is
+/// done. Results are thus not in input order, but each line starts with the
+/// index of the position. The transposition table is shared as usual. Like
+/// start_thinking() it returns at once: the main thread hands out the work and
+/// reports when all the threads are done, and 'stop' ends the run early.
+
+void ThreadPool::analyze(const std::vector<std::string>& fens, int depth) {
+
+  main()->wait_for_search_finished();
+
+  Search::LimitsType limits;
+  limits.startTime = now();
+  limits.infinite = 1; // No time management, threads stop at depth
+  limits.depth = depth;
+
+  stopOnPonderhit = stop = ponder = false;
+  Search::Limits = limits;
+  TT.new_search();
+
+  main()->run_custom_job([this, fens]() {
+
+      std::atomic<size_t> next(0), done(0);
+
+      auto worker = [&](Thread* th) {
+
+          th->independent = true;
+
+          for (size_t i; !stop && (i = next++) < fens.size(); )
+          {
+              StateInfo st;
+              th->rootPos.set(fens[i], Options["UCI_Chess960"], &st, th);
+              st.accumulator = th->accumulators;
+              st.accumulator->computed = false;
+              th->rootMoves.clear();
+
+              for (const auto& m : MoveList<LEGAL>(th->rootPos))
+                  th->rootMoves.emplace_back(m);
+
+              th->nodes = th->tbHits = th->nmpMinPly = 0;
+              th->rootDepth = th->completedDepth = DEPTH_ZERO;
+
+              if (!th->rootMoves.empty())
+                  th->Thread::search(); // Not the MainThread override
+
+              // A search cut short by 'stop' has no result worth printing
+              if (stop)
+                  break;
+
+              sync_cout << "position " << i + 1
+                        << " fen " << fens[i];
+
+              if (th->rootMoves.empty())
+                  std::cout << " bestmove (none)" << sync_endl;
+              else
+              {
+                  const Search::RootMove& rm = th->rootMoves[0];
+
+                  std::cout << " depth "    << th->completedDepth / ONE_PLY
+                            << " score "    << UCI::value(rm.score != -VALUE_INFINITE ? rm.score : rm.previousScore)
+                            << " nodes "    << th->nodes
+                            << " bestmove " << UCI::move(rm.pv[0]) << sync_endl;
+              }
+
+              ++done;
+          }
+
+          th->independent = false;
+      };
+
+      // The helpers use the locals of this job, so wait for them before leaving
+      for (Thread* th : *this)
+          if (th != main())
+              th->run_custom_job([&worker, th]() { worker(th); });
+
+      worker(main());
+
+      for (Thread* th : *this)
+          if (th != main())
+              th->wait_for_search_finished();
+
+      sync_cout << "analyzed " << done << " of " << fens.size() << " positions in "
+                << now() - Search::Limits.startTime + 1 << " ms" << sync_endl;
+  });
+}
+
+
+/// ThreadPool::stop_search() raises the stop flag, waking up the main thread
+/// if it is waiting in wait_for_stop(). The flag is changed under stopMutex
+/// so that the wake up cannot be lost, while searching threads keep polling
+/// it as a plain atomic.
+
+void ThreadPool::stop_search() {
+
+  std::lock_guard<Mutex> lk(stopMutex);
+  stop = true;
+  stopCv.notify_one();
+}
+
+
+/// ThreadPool::ponderhit() is called when the GUI sends 'ponderhit', i.e. the
+/// user has played the expected move. We should continue searching but switch
+/// from pondering to normal search, unless stopOnPonderhit is set: then we are
+/// waiting for 'ponderhit' to stop the search, for instance if max search
+/// depth is reached.
+
+void ThreadPool::ponderhit() {
+
+  std::lock_guard<Mutex> lk(stopMutex);
+
+  if (stopOnPonderhit)
+      stop = true;
+  else
+      ponder = false; // Switch to normal search
+
+  stopCv.notify_one();
+}
+
+
+/// ThreadPool::wait_for_stop() blocks the main thread, when it has finished
+/// searching while pondering or in an infinite search, until the GUI sends
+/// 'stop' or 'ponderhit'.
+
+void ThreadPool::wait_for_stop() {
+
+  std::unique_lock<Mutex> lk(stopMutex);
+  stopCv.wait(lk, [&]{ return stop || !(ponder || Search::Limits.infinite); });
+}
+
+
+/// ThreadPool::tt_stats() sums up the transposition table counters of all the
+/// threads. Counters are read without synchronization, so while searching the
+/// result is only approximate.
+
+TTStats ThreadPool::tt_stats() const {
+
+  TTStats sum = TTStats();
+  for (Thread* th : *this)
+      sum += th->ttStats;
+  return sum;
+}
+
 /// ThreadPool::start_thinking() wakes up main thread waiting in idle_loop() and
 /// returns immediately. Main thread will wake up other threads and start the search.
 
@@ -175,29 +368,28 @@ void ThreadPool::start_thinking(Position& pos, StateListPtr& states,
   if (!rootMoves.empty())
       Tablebases::rank_root_moves(pos, rootMoves);
 
-  // After ownership transfer 'states' becomes empty, so if we stop the search
-  // and call 'go' again without setting a new position states.get() == NULL.
-  assert(states.get() || setupStates.get());
+  // The states are shared with the UCI layer, which keeps them to extend the
+  // current game with new moves. Elements of the list are never modified once
+  // added, so the searching threads can access them concurrently.
+  assert(states.get());
 
-  if (states.get())
-      setupStates = std::move(states); // Ownership transfer, states is now empty
+  setupStates = states;
 
   // We use Position::set() to set root position across threads. But there are
   // some StateInfo fields (previous, pliesFromNull, capturedPiece) that cannot
-  // be deduced from a fen string, so set() clears them and to not lose the info
-  // we need to backup and later restore setupStates->back(). Note that setupStates
-  // is shared by threads but is accessed in read-only mode.
-  StateInfo tmp = setupStates->back();
-
+  // be deduced from a fen string, so each thread gets its own copy of
+  // setupStates->back() as root state, which the search may then update (the
+  // NNUE accumulator). Note that setupStates is accessed in read-only mode.
   for (Thread* th : *this)
   {
       th->nodes = th->tbHits = th->nmpMinPly = 0;
       th->rootDepth = th->completedDepth = DEPTH_ZERO;
       th->rootMoves = rootMoves;
-      th->rootPos.set(pos.fen(), pos.is_chess960(), &setupStates->back(), th);
+      th->rootPos.set(pos.fen(), pos.is_chess960(), &th->rootState, th);
+      th->rootState = setupStates->back();
+      th->rootState.accumulator = th->accumulators;
+      th->rootState.accumulator->computed = false; // Could be from another network
   }
 
-  setupStates->back() = tmp;
-
   main()->start_searching();
 }
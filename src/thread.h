@@ -23,16 +23,20 @@
 
 #include <atomic>
 #include <condition_variable>
+#include <functional>
 #include <mutex>
+#include <string>
 #include <thread>
 #include <vector>
 
+#include "evaluate.h"
 #include "material.h"
 #include "movepick.h"
 #include "pawns.h"
 #include "position.h"
 #include "search.h"
 #include "thread_win32.h"
+#include "tt.h"
 
 
 /// Thread class keeps together all the thread-related stuff. We use
@@ -46,6 +50,7 @@ class Thread {
   ConditionVariable cv;
   size_t idx;
   bool exit = false, searching = true; // Set before starting std::thread
+  std::function<void()> jobFunc;
   std::thread stdThread;
 
 public:
@@ -55,17 +60,20 @@ public:
   void clear();
   void idle_loop();
   void start_searching();
+  void run_custom_job(std::function<void()> f);
   void wait_for_search_finished();
 
   Pawns::Table pawnsTable;
-  Material::Table materialTable;
-  Endgames endgames;
+  Eval::Cache evalCache;
   size_t pvIdx, pvLast;
   int selDepth, nmpMinPly;
   Color nmpColor;
-  std::atomic<uint64_t> nodes, tbHits;
+  std::atomic<uint64_t> nodes, tbHits, majorFaults;
+  TTStats ttStats;
 
   Position rootPos;
+  StateInfo rootState;
+  Eval::NNUE::Accumulator* accumulators; // Stack indexed by ply, see StateInfo::accumulator
   Search::RootMoves rootMoves;
   Depth rootDepth, completedDepth;
   CounterMoveHistory counterMoves;
@@ -73,6 +81,7 @@ public:
   CapturePieceToHistory captureHistory;
   ContinuationHistory contHistory;
   Score contempt;
+  bool independent; // Searching its own root position, see ThreadPool::analyze()
 };
 
 
@@ -100,15 +109,34 @@ struct ThreadPool : public std::vector<Thread*> {
   void start_thinking(Position&, StateListPtr&, const Search::LimitsType&, bool = false);
   void clear();
   void set(size_t);
+  void analyze(const std::vector<std::string>& fens, int depth);
+  void stop_search();
+  void ponderhit();
+  void wait_for_stop();
 
   MainThread* main()        const { return static_cast<MainThread*>(front()); }
   uint64_t nodes_searched() const { return accumulate(&Thread::nodes); }
   uint64_t tb_hits()        const { return accumulate(&Thread::tbHits); }
+  uint64_t major_faults()   const { return accumulate(&Thread::majorFaults); }
+  TTStats tt_stats() const;
+
+  /// hash_stats() sums up the counters of one of the per-thread tables, as in
+  /// Threads.hash_stats(&Thread::pawnsTable). Like tt_stats() it does not
+  /// synchronize with the searching threads.
+  template<typename T>
+  HashStats hash_stats(T Thread::*table) const {
+    HashStats sum;
+    for (Thread* th : *this)
+        sum += (th->*table).stats;
+    return sum;
+  }
 
   std::atomic_bool stop, ponder, stopOnPonderhit;
 
 private:
   StateListPtr setupStates;
+  Mutex stopMutex;
+  ConditionVariable stopCv;
 
   uint64_t accumulate(std::atomic<uint64_t> Thread::* member) const {
 
@@ -18,66 +18,360 @@
   along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
-#include <cstring>   // For std::memset
+#include <cstddef>   // For offsetof
+#include <cstring>   // For std::memset and std::memcmp
+#include <fstream>
 #include <iostream>
 
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
 #include "bitboard.h"
+#include "thread.h"
 #include "tt.h"
 
 TranspositionTable TT; // Our global transposition table
 
-/// TTEntry::save saves a TTEntry
-void TTEntry::save(Key k, Value v, Bound b, Depth d, Move m, Value ev) {
+namespace {
+
+// Sink for the counters of threads that are not search threads
+TTStats UnboundStats;
+
+}
+
+thread_local TTStats* TranspositionTable::stats = &UnboundStats;
+
+namespace {
+
+/// Hash snapshot files store the raw cluster array followed by a trailer, so
+/// that the array starts at offset 0 and can be mapped directly as the table.
+/// All the trailer fields but generation8 must match the running build.
+
+struct SnapshotTrailer {
+  char magic[8];
+  uint32_t version;
+  uint32_t endianness;
+  uint32_t clusterSize;
+  uint32_t entrySize;
+  uint64_t clusterCount;
+  uint8_t generation8;
+  uint8_t padding[7];
+};
+
+constexpr size_t SnapshotCheckedBytes = offsetof(SnapshotTrailer, generation8);
+
+SnapshotTrailer snapshot_trailer(size_t clusterSize, size_t clusterCount, uint8_t gen8) {
+
+  SnapshotTrailer t;
+  std::memset(&t, 0, sizeof(t));
+  std::memcpy(t.magic, "MKRKHASH", 8);
+  t.version      = 1;
+  t.endianness   = 0x01020304;
+  t.clusterSize  = uint32_t(clusterSize);
+  t.entrySize    = uint32_t(sizeof(TTEntry));
+  t.clusterCount = clusterCount;
+  t.generation8  = gen8;
+  return t;
+}
+
+/// A table living in shared memory is followed by this header, placed at the
+/// start of the page after the clusters. It lets a process joining an existing
+/// segment validate it, and counts the attached processes so that the last one
+/// to detach removes the segment. Accesses are serialized with flock().
+
+struct SharedHeader {
+  char magic[8];
+  uint32_t clusterSize;
+  uint32_t entrySize;
+  uint64_t clusterCount;
+  uint32_t attached;
+};
+
+constexpr size_t SharedHeaderSpace = 4096;
+
+} // namespace
+
+/// TTEntryT::save saves a TTEntryT
+template<typename KeyType>
+void TTEntryT<KeyType>::save(Key k, Value v, Bound b, Depth d, Move m, Value ev) {
 
   assert(d / ONE_PLY * ONE_PLY == d);
 
+  const KeyType k2 = key_of(k);
+
   // Preserve any existing move for the same position
-  if (m || (k >> 48) != key16)
+  if (m || k2 != key)
       move16 = (uint16_t)m;
 
   // Overwrite less valuable entries
-  if (  (k >> 48) != key16
+  if (  k2 != key
       || d / ONE_PLY > depth8 - 4
       || b == BOUND_EXACT)
   {
-      key16     = (uint16_t)(k >> 48);
+      if (k2 != key)
+      {
+          TTStats* s = TranspositionTable::stats;
+
+          if (!key)
+              s->storedEmpty++;
+          else if ((genBound8 & 0xFC) != TT.generation8)
+              s->replacedAge++;
+          else
+              s->replacedDepth++;
+      }
+
+      key       = k2;
       value16   = (int16_t)v;
       eval16    = (int16_t)ev;
       genBound8 = (uint8_t)(TT.generation8 | b);
       depth8    = (int8_t)(d / ONE_PLY);
   }
+  else
+      TranspositionTable::stats->rejected++;
+}
+
+template struct TTEntryT<uint16_t>;
+template struct TTEntryT<uint32_t>;
+
+
+/// TTStats::operator+=() accumulates counters, used to sum up all the threads
+
+TTStats& TTStats::operator+=(const TTStats& s) {
+
+  probes        += s.probes;
+  hits          += s.hits;
+  collisions    += s.collisions;
+  storedEmpty   += s.storedEmpty;
+  replacedAge   += s.replacedAge;
+  replacedDepth += s.replacedDepth;
+  rejected      += s.rejected;
+  return *this;
+}
+
+
+/// operator<<(TTStats) prints the counters on a single line, with the hit
+/// rate and the collision rate measured on hits, in percent.
+
+std::ostream& operator<<(std::ostream& os, const TTStats& s) {
+
+  os << "probes "          << s.probes
+     << " hits "           << s.hits
+     << " hitrate "        << (s.probes ? 100.0 * s.hits / s.probes : 0.0)
+     << " collisions "     << s.collisions
+     << " collisionrate "  << (s.hits ? 100.0 * s.collisions / s.hits : 0.0)
+     << " stored-empty "   << s.storedEmpty
+     << " replaced-age "   << s.replacedAge
+     << " replaced-depth " << s.replacedDepth
+     << " rejected "       << s.rejected;
+
+  return os;
 }
 
 
 /// TranspositionTable::resize() sets the size of the transposition table,
 /// measured in megabytes. Transposition table consists of a power of 2 number
 /// of clusters and each cluster consists of ClusterSize number of TTEntry.
+/// The table is backed by huge pages when available, see large_pages_alloc(),
+/// or by a POSIX shared memory segment when one has been set with share().
 
 void TranspositionTable::resize(size_t mbSize) {
 
+  static bool firstCall = true;
+  size_t pageSize;
+
+  free_table();
+
   clusterCount = mbSize * 1024 * 1024 / sizeof(Cluster);
 
-  free(mem);
-  mem = malloc(clusterCount * sizeof(Cluster) + CacheLineSize - 1);
+  if (!sharedName.empty())
+  {
+      if (attach_shared())
+      {
+          firstCall = false;
+          return;
+      }
+
+      sync_cout << "info string Could not attach to shared memory " << sharedName
+                << ", using a private table" << sync_endl;
+  }
+
+  table = (Cluster*)large_pages_alloc(clusterCount * sizeof(Cluster), pageSize);
 
-  if (!mem)
+  if (!table)
   {
       std::cerr << "Failed to allocate " << mbSize
                 << "MB for transposition table." << std::endl;
       exit(EXIT_FAILURE);
   }
 
-  table = (Cluster*)((uintptr_t(mem) + CacheLineSize - 1) & ~(CacheLineSize - 1));
+  // Suppress the report on the first call, which happens at startup before
+  // 'uci' is received and whose output would confuse some GUIs.
+  if (!firstCall)
+      sync_cout << "info string Hash table allocation: "
+                << (pageSize ? std::to_string(pageSize >> 20) + "MB huge pages"
+                             : std::string("default pages"))
+                << sync_endl;
+
+  firstCall = false;
   clear();
 }
 
 
+/// TranspositionTable::share() sets the name of the POSIX shared memory segment
+/// the table should live in, or "<empty>" for a private table, and reallocates
+/// the table with its current size. Processes sharing a segment must use the
+/// same 'Hash' size; entries are read and written with the usual lockless
+/// semantics, while each process keeps its own generation counter.
+
+void TranspositionTable::share(const std::string& name) {
+
+  sharedName = name == "<empty>" ? "" : name[0] == '/' ? name : "/" + name;
+  resize(clusterCount * sizeof(Cluster) / (1024 * 1024));
+}
+
+
+/// TranspositionTable::attach_shared() maps the shared memory segment named
+/// sharedName as the table, creating and sizing it if this is the first
+/// process to use it. Returns false if the segment cannot be used.
+
+bool TranspositionTable::attach_shared() {
+
+#if !defined(_WIN32) && !defined(__ANDROID__)
+  const size_t tableSize = clusterCount * sizeof(Cluster);
+  const size_t totalSize = tableSize + SharedHeaderSpace;
+  struct stat statbuf;
+
+  int fd = shm_open(sharedName.c_str(), O_CREAT | O_RDWR, 0600);
+
+  if (fd == -1)
+      return false;
+
+  flock(fd, LOCK_EX);
+  fstat(fd, &statbuf);
+
+  bool created = statbuf.st_size == 0;
+
+  void* mem = (size_t(statbuf.st_size) == totalSize || (created && !ftruncate(fd, totalSize)))
+            ? mmap(nullptr, totalSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)
+            : MAP_FAILED;
+
+  SharedHeader* h = mem != MAP_FAILED ? (SharedHeader*)((char*)mem + tableSize) : nullptr;
+
+  if (h && created)
+  {
+      std::memcpy(h->magic, "MKRKSHM1", 8);
+      h->clusterSize  = uint32_t(sizeof(Cluster));
+      h->entrySize    = uint32_t(sizeof(TTEntry));
+      h->clusterCount = clusterCount;
+      h->attached     = 0;
+  }
+
+  if (   h
+      && (   std::memcmp(h->magic, "MKRKSHM1", 8)
+          || h->clusterSize  != sizeof(Cluster)
+          || h->entrySize    != sizeof(TTEntry)
+          || h->clusterCount != clusterCount))
+  {
+      munmap(mem, totalSize);
+      h = nullptr;
+  }
+
+  if (!h)
+  {
+      if (created)
+          shm_unlink(sharedName.c_str());
+
+      flock(fd, LOCK_UN);
+      close(fd);
+      return false;
+  }
+
+  h->attached++;
+  flock(fd, LOCK_UN);
+
+  table = (Cluster*)mem;
+  backing = SHARED_MEMORY;
+  sharedFd = fd;
+
+  sync_cout << "info string Hash table attached to shared memory " << sharedName
+            << " (" << h->attached << " processes)" << sync_endl;
+  return true;
+#else
+  return false;
+#endif
+}
+
+
+/// TranspositionTable::free_table() releases the memory backing the table
+
+void TranspositionTable::free_table() {
+
+  const size_t tableSize = clusterCount * sizeof(Cluster);
+
+#ifndef _WIN32
+  if (backing == FILE_MAPPED)
+      munmap(table, tableSize);
+
+  else if (backing == SHARED_MEMORY)
+  {
+      SharedHeader* h = (SharedHeader*)((char*)table + tableSize);
+
+      flock(sharedFd, LOCK_EX);
+
+      if (--h->attached == 0)
+          shm_unlink(sharedName.c_str());
+
+      munmap(table, tableSize + SharedHeaderSpace);
+      flock(sharedFd, LOCK_UN);
+      close(sharedFd);
+  }
+  else
+#endif
+      large_pages_free(table, tableSize);
+
+  table = nullptr;
+  backing = ALLOCATED;
+}
+
+
 /// TranspositionTable::clear() initializes the entire transposition table to zero,
-//  in a multi-threaded way.
+/// in a multi-threaded way. Each search thread zeroes its own slice, so that on
+/// systems with a first-touch policy the pages end up spread across the nodes
+/// the threads are bound to.
 
 void TranspositionTable::clear() {
 
-  std::memset(table, 0, clusterCount * sizeof(Cluster));
+  const size_t threadCount = Threads.size();
+
+  // A shared table is filled cooperatively by other processes as well, so
+  // never wipe it: it starts zeroed when its segment is created.
+  if (backing == SHARED_MEMORY)
+      return;
+
+  if (!threadCount) // Called while the thread pool is being torn down
+  {
+      std::memset(table, 0, clusterCount * sizeof(Cluster));
+      return;
+  }
+
+  for (size_t idx = 0; idx < threadCount; ++idx)
+      Threads[idx]->run_custom_job([this, idx, threadCount]() {
+
+          const size_t stride = clusterCount / threadCount,
+                       start  = stride * idx,
+                       len    = idx != threadCount - 1 ? stride
+                                                       : clusterCount - start;
+
+          std::memset(&table[start], 0, len * sizeof(Cluster));
+      });
+
+  for (Thread* th : Threads)
+      th->wait_for_search_finished();
 }
 
 /// TranspositionTable::probe() looks up the current position in the transposition
@@ -90,15 +384,19 @@ void TranspositionTable::clear() {
 TTEntry* TranspositionTable::probe(const Key key, bool& found) const {
 
   TTEntry* const tte = first_entry(key);
-  const uint16_t key16 = key >> 48;  // Use the high 16 bits as key inside the cluster
+  const auto k2 = TTEntry::key_of(key); // Use the high bits as key inside the cluster
+
+  stats->probes++;
 
   for (int i = 0; i < ClusterSize; ++i)
-      if (!tte[i].key16 || tte[i].key16 == key16)
+      if (!tte[i].key || tte[i].key == k2)
       {
-          if ((tte[i].genBound8 & 0xFC) != generation8 && tte[i].key16)
+          if ((tte[i].genBound8 & 0xFC) != generation8 && tte[i].key)
               tte[i].genBound8 = uint8_t(generation8 | tte[i].bound()); // Refresh
 
-          return found = (bool)tte[i].key16, &tte[i];
+          stats->hits += bool(tte[i].key);
+
+          return found = (bool)tte[i].key, &tte[i];
       }
 
   // Find an entry to be replaced according to the replacement strategy
@@ -131,3 +429,91 @@ int TranspositionTable::hashfull() const {
   }
   return cnt;
 }
+
+
+/// TranspositionTable::save() dumps the whole table and the current generation
+/// to a snapshot file, to be restored later with load().
+
+bool TranspositionTable::save(const std::string& fname) const {
+
+  SnapshotTrailer t = snapshot_trailer(sizeof(Cluster), clusterCount, generation8);
+  std::ofstream file(fname, std::ios::binary);
+
+  file.write((const char*)table, clusterCount * sizeof(Cluster));
+  file.write((const char*)&t, sizeof(t));
+  file.close();
+
+  if (!file)
+  {
+      sync_cout << "info string Failed to write hash snapshot " << fname << sync_endl;
+      return false;
+  }
+
+  sync_cout << "info string Hash saved to " << fname << sync_endl;
+  return true;
+}
+
+
+/// TranspositionTable::load() restores a snapshot written by save(). The file
+/// must come from a build with the same table layout and its size must match
+/// the current 'Hash' setting. Where available the file is mapped privately as
+/// the new table, so that loading is lazy and the file is never written back.
+
+bool TranspositionTable::load(const std::string& fname) {
+
+  const size_t tableSize = clusterCount * sizeof(Cluster);
+  SnapshotTrailer expected = snapshot_trailer(sizeof(Cluster), clusterCount, 0);
+  SnapshotTrailer t;
+
+  std::ifstream file(fname, std::ios::binary | std::ios::ate);
+
+  if (!file.is_open())
+  {
+      sync_cout << "info string Unable to open hash snapshot " << fname << sync_endl;
+      return false;
+  }
+
+  bool valid =  size_t(file.tellg()) == tableSize + sizeof(t)
+             && file.seekg(tableSize).read((char*)&t, sizeof(t))
+             && !std::memcmp(&t, &expected, SnapshotCheckedBytes);
+
+  if (!valid)
+  {
+      sync_cout << "info string Hash snapshot " << fname
+                << " does not match this build or the current Hash size" << sync_endl;
+      return false;
+  }
+
+#ifndef _WIN32
+  file.close();
+
+  int fd = ::open(fname.c_str(), O_RDONLY);
+  void* mem = fd == -1 ? MAP_FAILED
+            : mmap(nullptr, tableSize, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+
+  if (fd != -1)
+      ::close(fd);
+
+  if (mem == MAP_FAILED)
+  {
+      sync_cout << "info string Could not mmap() hash snapshot " << fname << sync_endl;
+      return false;
+  }
+
+  free_table();
+  table = (Cluster*)mem;
+  backing = FILE_MAPPED;
+#else
+  if (!file.seekg(0).read((char*)table, tableSize))
+  {
+      sync_cout << "info string Failed to read hash snapshot " << fname << sync_endl;
+      clear();
+      return false;
+  }
+#endif
+
+  generation8 = t.generation8;
+
+  sync_cout << "info string Hash loaded from " << fname << sync_endl;
+  return true;
+}
@@ -21,12 +21,17 @@
 #ifndef TT_H_INCLUDED
 #define TT_H_INCLUDED
 
+#include <ostream>
+#include <string>
+
 #include "misc.h"
 #include "types.h"
 
-/// TTEntry struct is the 10 bytes transposition table entry, defined as below:
+/// TTEntryT struct is the transposition table entry, templated on the type of
+/// the verification key, which holds the highest order bits of the position
+/// key. It is 10 bytes with a 16 bit key and 12 bytes with a 32 bit key:
 ///
-/// key        16 bit
+/// key     16/32 bit
 /// move       16 bit
 /// value      16 bit
 /// eval value 16 bit
@@ -34,7 +39,8 @@
 /// bound type  2 bit
 /// depth       8 bit
 
-struct TTEntry {
+template<typename KeyType>
+struct TTEntryT {
 
   Move  move()  const { return (Move )move16; }
   Value value() const { return (Value)value16; }
@@ -43,10 +49,12 @@ struct TTEntry {
   Bound bound() const { return (Bound)(genBound8 & 0x3); }
   void save(Key k, Value v, Bound b, Depth d, Move m, Value ev);
 
+  static KeyType key_of(Key k) { return KeyType(k >> (64 - 8 * sizeof(KeyType))); }
+
 private:
   friend class TranspositionTable;
 
-  uint16_t key16;
+  KeyType  key;
   uint16_t move16;
   int16_t  value16;
   int16_t  eval16;
@@ -55,6 +63,54 @@ private:
 };
 
 
+/// TTCluster is a group of Entries TTEntryT padded to Bytes bytes. The cluster
+/// format is chosen at compile time with TT_CLUSTER_BYTES (see the 'ttcluster'
+/// flag in the Makefile): 32 bytes clusters of three entries with 16 bit keys
+/// give the best memory density, 64 bytes clusters of five entries with 32 bit
+/// keys trade some of it for a much lower rate of key collisions.
+
+template<typename KeyType, int Entries, int Bytes>
+struct TTCluster {
+
+  typedef TTEntryT<KeyType> Entry;
+  static constexpr int Size = Entries;
+
+  Entry entry[Entries];
+  char padding[Bytes - Entries * sizeof(Entry)]; // Align to a divisor of the cache line size
+};
+
+#ifndef TT_CLUSTER_BYTES
+#define TT_CLUSTER_BYTES 32
+#endif
+
+#if TT_CLUSTER_BYTES == 64
+typedef TTCluster<uint32_t, 5, 64> TTClusterFormat;
+#elif TT_CLUSTER_BYTES == 32
+typedef TTCluster<uint16_t, 3, 32> TTClusterFormat;
+#else
+#error "TT_CLUSTER_BYTES must be 32 or 64"
+#endif
+
+typedef TTClusterFormat::Entry TTEntry;
+
+
+/// TTStats keeps the transposition table counters of a single thread. Stores
+/// are classified by what they overwrite: an empty slot, an entry of an older
+/// search (age) or an entry of the current search (depth). A store that keeps
+/// the existing entry for the same position is rejected. Collisions are tt
+/// moves found not pseudo legal, i.e. verification key false positives (or
+/// SMP races).
+
+struct TTStats {
+  uint64_t probes, hits, collisions;
+  uint64_t storedEmpty, replacedAge, replacedDepth, rejected;
+
+  TTStats& operator+=(const TTStats& s);
+};
+
+std::ostream& operator<<(std::ostream& os, const TTStats& s);
+
+
 /// A TranspositionTable consists of a power of 2 number of clusters and each
 /// cluster consists of ClusterSize number of TTEntry. Each non-empty entry
 /// contains information of exactly one position. The size of a cluster should
@@ -65,22 +121,24 @@ private:
 class TranspositionTable {
 
   static constexpr int CacheLineSize = 64;
-  static constexpr int ClusterSize = 3;
+  static constexpr int ClusterSize = TTClusterFormat::Size;
 
-  struct Cluster {
-    TTEntry entry[ClusterSize];
-    char padding[2]; // Align to a divisor of the cache line size
-  };
+  typedef TTClusterFormat Cluster;
 
   static_assert(CacheLineSize % sizeof(Cluster) == 0, "Cluster size incorrect");
 
 public:
- ~TranspositionTable() { free(mem); }
+ ~TranspositionTable() { free_table(); }
   void new_search() { generation8 += 4; } // Lower 2 bits are used by Bound
   TTEntry* probe(const Key key, bool& found) const;
   int hashfull() const;
   void resize(size_t mbSize);
   void clear();
+  void share(const std::string& name);
+  static void bind_stats(TTStats* s) { stats = s; }
+  static void record_collision() { stats->collisions++; }
+  bool save(const std::string& fname) const;
+  bool load(const std::string& fname);
 
   // The 32 lowest order bits of the key are used to get the index of the cluster
   TTEntry* first_entry(const Key key) const {
@@ -88,12 +146,22 @@ public:
   }
 
 private:
-  friend struct TTEntry;
+  friend struct TTEntryT<uint16_t>;
+  friend struct TTEntryT<uint32_t>;
+
+  static thread_local TTStats* stats; // Counters of the calling thread
+
+  enum Backing { ALLOCATED, FILE_MAPPED, SHARED_MEMORY };
+
+  bool attach_shared();
+  void free_table();
 
   size_t clusterCount;
   Cluster* table;
-  void* mem;
-  uint8_t generation8; // Size must be not bigger than TTEntry::genBound8
+  Backing backing;
+  int sharedFd;
+  std::string sharedName; // Name of the POSIX shared memory segment, if any
+  uint8_t generation8; // Size must be not bigger than TTEntryT::genBound8
 };
 
 extern TranspositionTable TT;
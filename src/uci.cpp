@@ -18,11 +18,15 @@
   along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <algorithm>
 #include <cassert>
+#include <fstream>
 #include <iostream>
 #include <sstream>
 #include <string>
+#include <thread>
 
+#include "bitboard.h"
 #include "evaluate.h"
 #include "movegen.h"
 #include "position.h"
@@ -36,6 +40,7 @@
 using namespace std;
 
 extern vector<string> setup_bench(const Position&, istream&);
+extern void bench_micro(const Position&, istream&);
 
 namespace {
 
@@ -46,12 +51,18 @@ namespace {
   // position() is called when engine receives the "position" UCI command.
   // The function sets up the position described in the given FEN string ("fen")
   // or the starting position ("startpos") and then makes the moves given in the
-  // following move list ("moves").
+  // following move list ("moves"). GUIs send the whole game at every move, so
+  // when the command extends the previous one only the new moves are made.
 
   void position(Position& pos, istringstream& is, StateListPtr& states) {
 
+    static string lastFen;
+    static vector<string> lastMoves;
+    static Key lastKey = 0;
+
     Move m;
     string token, fen;
+    vector<string> moves;
 
     is >> token;
 
@@ -66,15 +77,37 @@ namespace {
     else
         return;
 
-    states = StateListPtr(new std::deque<StateInfo>(1)); // Drop old and create a new one
-    pos.set(fen, Options["UCI_Chess960"], &states->back(), Threads.main());
+    while (is >> token)
+        moves.push_back(token);
+
+    // Position could have been changed by other commands since, e.g. by 'flip',
+    // and resizing the thread pool leaves it pointing at a deleted main thread
+    bool extends =  fen == lastFen
+                 && pos.key() == lastKey
+                 && pos.this_thread() == Threads.main()
+                 && moves.size() >= lastMoves.size()
+                 && std::equal(lastMoves.begin(), lastMoves.end(), moves.begin());
 
-    // Parse move list (if any)
-    while (is >> token && (m = UCI::to_move(pos, token)) != MOVE_NONE)
+    if (!extends)
     {
+        states = StateListPtr(new std::deque<StateInfo>(1)); // Drop old and create a new one
+        pos.set(fen, Options["UCI_Chess960"], &states->back(), Threads.main());
+        lastMoves.clear();
+    }
+
+    // Parse move list (if any), stopping at the first illegal move
+    for (size_t i = lastMoves.size(); i < moves.size(); ++i)
+    {
+        if ((m = UCI::to_move(pos, moves[i])) == MOVE_NONE)
+            break;
+
         states->emplace_back();
         pos.do_move(m, states->back());
+        lastMoves.push_back(moves[i]);
     }
+
+    lastFen = fen;
+    lastKey = pos.key();
   }
 
 
@@ -136,16 +169,16 @@ namespace {
   }
 
 
-  // bench() is called when engine receives the "bench" command. Firstly
-  // a list of UCI commands is setup according to bench parameters, then
-  // it is run one by one printing a summary at the end.
+  // run_bench() runs a list of commands built by setup_bench(), adding the
+  // nodes searched to 'nodes' and to 'threadNodes' per thread, and returns
+  // the elapsed time in milliseconds.
 
-  void bench(Position& pos, istream& args, StateListPtr& states) {
+  TimePoint run_bench(Position& pos, const vector<string>& list, StateListPtr& states,
+                      uint64_t& nodes, vector<uint64_t>& threadNodes) {
 
     string token;
-    uint64_t num, nodes = 0, cnt = 1;
+    uint64_t num, cnt = 1;
 
-    vector<string> list = setup_bench(pos, args);
     num = count_if(list.begin(), list.end(), [](string s) { return s.find("go ") == 0; });
 
     TimePoint elapsed = now();
@@ -161,13 +194,110 @@ namespace {
             go(pos, is, states);
             Threads.main()->wait_for_search_finished();
             nodes += Threads.nodes_searched();
+
+            threadNodes.resize(Threads.size());
+            for (size_t i = 0; i < Threads.size(); ++i)
+                threadNodes[i] += Threads[i]->nodes;
         }
         else if (token == "setoption")  setoption(is);
         else if (token == "position")   position(pos, is, states);
         else if (token == "ucinewgame") Search::clear();
     }
 
-    elapsed = now() - elapsed + 1; // Ensure positivity to avoid a 'divide by zero'
+    return now() - elapsed + 1; // Ensure positivity to avoid a 'divide by zero'
+  }
+
+
+  // bench_smp() runs the bench positions to a fixed depth with 1, 2, 4, ...
+  // threads up to the given maximum, and prints for each thread count the nps
+  // speedup, the time-to-depth speedup and the node overhead with respect to
+  // one thread, as one JSON object per line. A thread count is skipped when
+  // it is beyond the limits of the Threads option.
+  //
+  // bench smp -> up to the number of hardware threads, depth 14, 16MB hash
+  // bench smp 256 8 16 -> up to 8 threads, depth 16, 256MB hash
+
+  void bench_smp(Position& pos, istream& args, StateListPtr& states) {
+
+    struct Run { size_t threads; TimePoint time; uint64_t nodes; };
+
+    string token;
+    string ttSize  = (args >> token) ? token : "16";
+    string threads = (args >> token) ? token : to_string(std::max(1u, std::thread::hardware_concurrency()));
+    string depth   = (args >> token) ? token : "14";
+    string fenFile = (args >> token) ? token : "default";
+
+    size_t maxThreads = std::max(1, atoi(threads.c_str()));
+    vector<size_t> counts;
+    vector<Run> runs;
+
+    for (size_t n = 1; n < maxThreads; n *= 2)
+        counts.push_back(n);
+    counts.push_back(maxThreads);
+
+    for (size_t n : counts)
+    {
+        istringstream is(ttSize + " " + to_string(n) + " " + depth + " " + fenFile + " depth");
+        vector<string> list = setup_bench(pos, is);
+        vector<uint64_t> threadNodes;
+        uint64_t nodes = 0;
+
+        TimePoint elapsed = run_bench(pos, list, states, nodes, threadNodes);
+
+        if (Threads.size() != n)
+            continue;
+
+        runs.push_back({n, elapsed, nodes});
+    }
+
+    if (runs.empty() || runs[0].threads != 1)
+        return;
+
+    const Run& base = runs[0];
+
+    for (const Run& r : runs)
+    {
+        uint64_t nps = 1000 * r.nodes / r.time;
+
+        sync_cout << "{\"threads\":"       << r.threads
+                  << ",\"time\":"          << r.time
+                  << ",\"nodes\":"         << r.nodes
+                  << ",\"nps\":"           << nps
+                  << ",\"npsspeedup\":"    << double(nps) / (1000 * base.nodes / base.time)
+                  << ",\"ttdspeedup\":"    << double(base.time) / r.time
+                  << ",\"nodeoverhead\":"  << double(r.nodes) / base.nodes - 1
+                  << "}" << sync_endl;
+    }
+  }
+
+
+  // bench() is called when engine receives the "bench" command. Firstly
+  // a list of UCI commands is setup according to bench parameters, then
+  // it is run one by one printing a summary at the end. "bench micro" runs
+  // the micro benchmarks of the hot paths instead, see bench_micro(), and
+  // "bench smp" measures the scaling with the number of threads.
+
+  void bench(Position& pos, istream& args, StateListPtr& states) {
+
+    string token;
+    uint64_t nodes = 0;
+    vector<uint64_t> threadNodes;
+    streampos argsStart = args.tellg();
+
+    if (args >> token && (token == "micro" || token == "smp"))
+    {
+        if (token == "micro")
+            bench_micro(pos, args);
+        else
+            bench_smp(pos, args, states);
+        return;
+    }
+
+    args.clear();
+    args.seekg(argsStart);
+
+    vector<string> list = setup_bench(pos, args);
+    TimePoint elapsed = run_bench(pos, list, states, nodes, threadNodes);
 
     dbg_print(); // Just before exiting
 
@@ -175,6 +305,47 @@ namespace {
          << "\nTotal time (ms) : " << elapsed
          << "\nNodes searched  : " << nodes
          << "\nNodes/second    : " << 1000 * nodes / elapsed << endl;
+
+    cerr << "Pawn hash hits  : " << 100 * Threads.hash_stats(&Thread::pawnsTable).hit_rate() << "%" << endl;
+
+    if (Options["Eval Cache"])
+        cerr << "Eval cache hits : " << 100 * Threads.hash_stats(&Thread::evalCache).hit_rate() << "%" << endl;
+
+    cerr << "Major faults    : " << Threads.major_faults() << endl;
+
+    // Per-thread speed, to spot threads running on remote memory or busy cores
+    if (threadNodes.size() > 1)
+        for (size_t i = 0; i < threadNodes.size(); ++i)
+            cerr << "Thread " << i << (i < 10 ? "        : " : "       : ")
+                 << 1000 * threadNodes[i] / elapsed << " nps" << endl;
+  }
+
+
+  // analyze() is called when engine receives the "analyze" command, followed
+  // by the name of a file with one FEN per line and the search depth. Positions
+  // are searched in parallel, one per thread, see ThreadPool::analyze(). As for
+  // 'go', the command returns at once and 'stop' interrupts the run.
+
+  void analyze(istream& is) {
+
+    string fenFile, fen;
+    int depth = 14;
+    vector<string> fens;
+
+    is >> fenFile >> depth;
+    ifstream file(fenFile);
+
+    if (!file.is_open())
+    {
+        sync_cout << "Unable to open file " << fenFile << sync_endl;
+        return;
+    }
+
+    while (getline(file, fen))
+        if (!fen.empty())
+            fens.push_back(fen);
+
+    Threads.analyze(fens, depth);
   }
 
 } // namespace
@@ -207,18 +378,11 @@ void UCI::loop(int argc, char* argv[]) {
       token.clear(); // Avoid a stale if getline() returns empty or blank line
       is >> skipws >> token;
 
-      // The GUI sends 'ponderhit' to tell us the user has played the expected move.
-      // So 'ponderhit' will be sent if we were told to ponder on the same move the
-      // user has played. We should continue searching but switch from pondering to
-      // normal search. In case Threads.stopOnPonderhit is set we are waiting for
-      // 'ponderhit' to stop the search, for instance if max search depth is reached.
-      if (    token == "quit"
-          ||  token == "stop"
-          || (token == "ponderhit" && Threads.stopOnPonderhit))
-          Threads.stop = true;
+      if (token == "quit" || token == "stop")
+          Threads.stop_search();
 
       else if (token == "ponderhit")
-          Threads.ponder = false; // Switch to normal search
+          Threads.ponderhit();
 
       else if (token == "uci")
           sync_cout << "id name " << engine_info(true)
@@ -234,8 +398,42 @@ void UCI::loop(int argc, char* argv[]) {
       // Additional custom non-UCI commands, mainly for debugging
       else if (token == "flip")  pos.flip();
       else if (token == "bench") bench(pos, is, states);
+      else if (token == "tbgen")
+      {
+          string path;
+          is >> path;
+          Threads.main()->wait_for_search_finished();
+
+          // Tablebases and bitbases are written under the given directory,
+          // then the ones of the options are reloaded.
+          Bitbases::generate(path);
+          Bitbases::init(Options["BitbasePath"]);
+          Tablebases::init(Options["SyzygyPath"]);
+      }
+      else if (token == "analyze") analyze(is);
       else if (token == "d")     sync_cout << pos << sync_endl;
       else if (token == "eval")  sync_cout << Eval::trace(pos) << sync_endl;
+      else if (token == "stats") sync_cout << dbg_stats() << sync_endl;
+      else if (token == "ttstats")
+      {
+          sync_cout << "hashfull " << TT.hashfull();
+
+          for (size_t i = 0; i < Threads.size(); ++i)
+              std::cout << "\nthread " << i << " " << Threads[i]->ttStats;
+
+          std::cout << "\ntotal " << Threads.tt_stats() << sync_endl;
+      }
+      else if (token == "savehash" || token == "loadhash")
+      {
+          string fname;
+          is >> fname;
+          Threads.main()->wait_for_search_finished();
+
+          if (token == "savehash")
+              TT.save(fname);
+          else
+              TT.load(fname);
+      }
       else
           sync_cout << "Unknown command: " << cmd << sync_endl;
 
@@ -295,16 +493,32 @@ string UCI::move(Move m) {
 
 
 /// UCI::to_move() converts a string representing a move in coordinate notation
-/// (g1f3, a7a8q) to the corresponding legal Move, if any.
+/// (g1f3, a7a8q) to the corresponding legal Move, if any. The move is decoded
+/// directly and then validated, instead of matching against all the legal moves.
 
 Move UCI::to_move(const Position& pos, string& str) {
 
   if (str.length() == 5) // Junior could send promotion piece in uppercase
       str[4] = char(tolower(str[4]));
 
-  for (const auto& m : MoveList<LEGAL>(pos))
-      if (str == UCI::move(m))
-          return m;
+  if (   (str.length() != 4 && str.length() != 5)
+      || str[0] < 'a' || str[0] > 'h' || str[1] < '1' || str[1] > '8'
+      || str[2] < 'a' || str[2] > 'h' || str[3] < '1' || str[3] > '8')
+      return MOVE_NONE;
+
+  Square from = make_square(File(str[0] - 'a'), Rank(str[1] - '1'));
+  Square to   = make_square(File(str[2] - 'a'), Rank(str[3] - '1'));
+  Move m = make_move(from, to);
+
+  if (str.length() == 5)
+  {
+      size_t pt = string(" pmsnrk").find(str[4]);
+
+      if (pt == string::npos || pt < QUEEN || pt > ROOK)
+          return MOVE_NONE;
+
+      m = make<PROMOTION>(from, to, PieceType(pt));
+  }
 
-  return MOVE_NONE;
+  return is_ok(m) && pos.pseudo_legal(m) && pos.legal(m) ? m : MOVE_NONE;
 }
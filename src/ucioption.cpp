@@ -22,6 +22,8 @@
 #include <cassert>
 #include <ostream>
 
+#include "bitboard.h"
+#include "evaluate.h"
 #include "misc.h"
 #include "search.h"
 #include "thread.h"
@@ -38,9 +40,14 @@ namespace UCI {
 /// 'On change' actions, triggered by an option's value change
 void on_clear_hash(const Option&) { Search::clear(); }
 void on_hash_size(const Option& o) { TT.resize(o); }
+void on_hash_shared(const Option& o) { TT.share(o); }
 void on_logger(const Option& o) { start_logger(o); }
+void on_telemetry(const Option& o) { start_telemetry(o); }
 void on_threads(const Option& o) { Threads.set(o); }
+void on_thread_config(const Option&) { Threads.set(Options["Threads"]); }
 void on_tb_path(const Option& o) { Tablebases::init(o); }
+void on_bb_path(const Option& o) { Bitbases::init(o); }
+void on_eval_file(const Option&) { Threads.main()->wait_for_search_finished(); Eval::init_NNUE(); }
 
 
 /// Our case insensitive less() function as required by UCI protocol
@@ -59,10 +66,17 @@ void init(OptionsMap& o) {
   constexpr int MaxHashMB = Is64Bit ? 131072 : 2048;
 
   o["Debug Log File"]        << Option("", on_logger);
+  o["Telemetry File"]        << Option("<empty>", on_telemetry);
   o["Contempt"]              << Option(21, -100, 100);
   o["Threads"]               << Option(1, 1, 512, on_threads);
+  o["Thread Binding"]        << Option("off", {"off", "compact", "spread"}, on_thread_config);
   o["Hash"]                  << Option(16, 1, MaxHashMB, on_hash_size);
   o["Clear Hash"]            << Option(on_clear_hash);
+  o["Shared Hash Name"]      << Option("<empty>", on_hash_shared);
+  o["TT Stats"]              << Option(false);
+  o["Perft Hash"]            << Option(0, 0, MaxHashMB);
+  o["Pawn Hash Entries"]     << Option(16384, 1, 1 << 24, on_thread_config);
+  o["Eval Cache"]            << Option(0, 0, 1024, on_thread_config);
   o["Ponder"]                << Option(false);
   o["MultiPV"]               << Option(1, 1, 500);
   o["Skill Level"]           << Option(20, 0, 20);
@@ -76,6 +90,10 @@ void init(OptionsMap& o) {
   o["SyzygyProbeDepth"]      << Option(1, 1, 100);
   o["Syzygy50MoveRule"]      << Option(false);
   o["SyzygyProbeLimit"]      << Option(6, 0, 6);
+  o["SyzygyPrefetch"]        << Option(false);
+  o["BitbasePath"]           << Option("<empty>", on_bb_path);
+  o["Use NNUE"]              << Option(false, on_eval_file);
+  o["EvalFile"]              << Option("makruk.nnue", on_eval_file);
 }
 
 
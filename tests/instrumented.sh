@@ -48,6 +48,7 @@ race:TTEntry::eval
 
 race:TranspositionTable::probe
 race:TranspositionTable::hashfull
+race:ThreadPool::tt_stats
 
 EOF
 
@@ -77,6 +78,21 @@ do
 
 done
 
+# position commands extending the previous one across a thread pool resize
+cat << EOF > position.txt
+position startpos moves a3a4
+setoption name Threads value 2
+position startpos moves a3a4 a6a5
+go nodes 1000
+isready
+quit
+EOF
+
+echo "$prefix $exeprefix ./stockfish < position.txt $postfix"
+eval "$prefix $exeprefix ./stockfish < position.txt $postfix"
+
+rm position.txt
+
 # more general testing, following an uci protocol exchange
 cat << EOF > game.exp
  set timeout 10
@@ -12,8 +12,11 @@ echo "perft testing started"
 
 cat << EOF > perft.exp
    set timeout 10
-   lassign \$argv pos depth result
+   lassign \$argv pos depth result threads hash
    spawn ./stockfish
+   if {\$threads ne ""} {
+      send "setoption name Threads value \$threads\\nsetoption name Perft Hash value \$hash\\n"
+   }
    send "position \$pos\\ngo perft \$depth\\n"
    expect "Nodes searched? \$result" {} timeout {exit 1}
    send "quit\\n"
@@ -21,6 +24,7 @@ cat << EOF > perft.exp
 EOF
 
 expect perft.exp startpos 5 6223994 > /dev/null
+expect perft.exp startpos 6 142078049 2 16 > /dev/null
 
 rm perft.exp
 